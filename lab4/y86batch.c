@@ -0,0 +1,253 @@
+/* Batch mode for y86sim: run the tests of a manifest on a pool of threads */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "y86sim.h"
+
+#define LINE_SIZE 1024
+
+typedef enum { TEST_PASS, TEST_FAIL, TEST_NEW, TEST_ERR } result_t;
+
+/* one line of the manifest: file.bin [max_steps] [expected] */
+typedef struct test {
+    char *bin;
+    int max_steps;
+    char *expected;     /* expected report, or NULL */
+    char *report;       /* where the report is written: file.sim */
+    result_t result;
+    int line;           /* TEST_FAIL: first line that differs */
+    char *why;          /* TEST_ERR: what went wrong */
+} test_t;
+
+typedef struct batch {
+    test_t *tests;
+    int ntests;
+    int next;           /* next test for a worker to take */
+    pthread_mutex_t lock;
+    engine_t run;
+    long long mem_size;
+} batch_t;
+
+static char *result_names[] = { "Pass", "Fail", "New ", "Err " };
+
+/* 'bin' with its ".bin" suffix replaced by 'suffix' */
+static char *swap_suffix(char *bin, char *suffix)
+{
+    int len = strlen(bin) - 4;
+    char *s = (char *)malloc(len + strlen(suffix) + 1);
+    memcpy(s, bin, len);
+    strcpy(s + len, suffix);
+    return s;
+}
+
+/* read all of file 'name', NULL if it can't be read */
+static char *read_file(char *name, long *len)
+{
+    FILE *f = fopen(name, "rb");
+    char *buf;
+
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    buf = (char *)malloc(*len + 1);
+    if (fread(buf, 1, *len, f) != (size_t)*len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+/*
+ * load_manifest: parse the tests listed in 'manifest' into 'b'
+ *     blank lines and lines starting with '#' are skipped
+ *
+ * return
+ *     0, or -1 on a bad manifest (after printing why)
+ */
+static int load_manifest(batch_t *b, char *manifest)
+{
+    FILE *f = fopen(manifest, "r");
+    char line[LINE_SIZE];
+    char *bin, *arg;
+    int lineno = 0, size = 0;
+    test_t *t;
+
+    if (!f) {
+        fprintf(stderr, "Can't open manifest '%s'\n", manifest);
+        return -1;
+    }
+    b->tests = NULL;
+    b->ntests = 0;
+    while (fgets(line, LINE_SIZE, f)) {
+        lineno++;
+        bin = strtok(line, " \t\r\n");
+        if (!bin || bin[0] == '#')
+            continue;
+        if (strlen(bin) < 4 || strcmp(bin + strlen(bin) - 4, ".bin")) {
+            fprintf(stderr, "%s:%d: '%s' is not a .bin file\n",
+                    manifest, lineno, bin);
+            fclose(f);
+            return -1;
+        }
+        if (b->ntests == size) {
+            size = size ? 2*size : 64;
+            b->tests = (test_t *)realloc(b->tests, size * sizeof(test_t));
+        }
+        t = &b->tests[b->ntests++];
+        t->bin = strdup(bin);
+        t->max_steps = MAX_STEP;
+        t->expected = NULL;
+        t->report = swap_suffix(bin, ".sim");
+
+        arg = strtok(NULL, " \t\r\n");
+        if (arg && strspn(arg, "0123456789") == strlen(arg)) {
+            t->max_steps = atoi(arg);
+            arg = strtok(NULL, " \t\r\n");
+        }
+        if (arg)
+            t->expected = strdup(arg);
+        else {
+            /* default: file.sim.base next to file.bin, if there is one */
+            t->expected = swap_suffix(bin, ".sim.base");
+            if (access(t->expected, R_OK)) {
+                free(t->expected);
+                t->expected = NULL;
+            }
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/* run test 't' on 'sim', write its report and compare it with t->expected */
+static void run_test(batch_t *b, test_t *t, y86sim_t *sim)
+{
+    char *out = NULL, *exp;
+    size_t len = 0;
+    long exp_len = 0, i;
+    FILE *f;
+
+    t->result = TEST_ERR;
+    sim->out = open_memstream(&out, &len);
+    if (sim_file(sim, t->bin, b->run, t->max_steps) < 0)
+        t->why = "not loaded, see the report";
+    else
+        t->why = NULL;
+    fclose(sim->out);
+    sim->out = stdout;
+
+    f = fopen(t->report, "w");
+    if (f) {
+        fwrite(out, 1, len, f);
+        fclose(f);
+    } else if (!t->why)
+        t->why = "can't write the report";
+
+    if (t->why)
+        ;
+    else if (!t->expected)
+        t->result = TEST_NEW;
+    else if (!(exp = read_file(t->expected, &exp_len)))
+        t->why = "can't read the expected report";
+    else {
+        t->result = TEST_PASS;
+        if ((size_t)exp_len != len || memcmp(exp, out, len)) {
+            t->result = TEST_FAIL;
+            t->line = 1;
+            for (i = 0; i < (long)len && i < exp_len && out[i] == exp[i]; i++)
+                if (out[i] == '\n')
+                    t->line++;
+        }
+        free(exp);
+    }
+    free(out);
+}
+
+/* worker thread: take tests until there are none left */
+static void *worker(void *arg)
+{
+    batch_t *b = (batch_t *)arg;
+    y86sim_t *sim = new_y86sim(b->mem_size);
+    snapshot_t *blank = take_snapshot(sim);
+    int i;
+
+    for (;;) {
+        pthread_mutex_lock(&b->lock);
+        i = b->next++;
+        pthread_mutex_unlock(&b->lock);
+        if (i >= b->ntests)
+            break;
+
+        /* start each test from a clean image, keeping the allocations */
+        restore_snapshot(sim, blank);
+        if (sim->ic)
+            icache_flush(sim);
+        run_test(b, &b->tests[i], sim);
+    }
+
+    free_snapshot(blank);
+    free_y86sim(sim);
+    return NULL;
+}
+
+/*
+ * run_batch: run every test of 'manifest' with 'threads' workers
+ *     (0: one per CPU), writing each report to file.sim and comparing it
+ *     with the expected one, then print a summary
+ *
+ * return
+ *     0 if no test failed, 1 otherwise (the exit status of y86sim -b)
+ */
+int run_batch(char *manifest, int threads, engine_t run, long long mem_size)
+{
+    batch_t b;
+    pthread_t *tid;
+    int i, count[TEST_ERR+1] = { 0 };
+    test_t *t;
+
+    if (load_manifest(&b, manifest) < 0)
+        return 1;
+    b.next = 0;
+    b.run = run;
+    b.mem_size = mem_size;
+    pthread_mutex_init(&b.lock, NULL);
+
+    if (!threads)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > b.ntests)
+        threads = b.ntests;
+    if (threads < 1)
+        threads = 1;
+    tid = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    for (i = 0; i < threads; i++)
+        pthread_create(&tid[i], NULL, worker, &b);
+    for (i = 0; i < threads; i++)
+        pthread_join(tid[i], NULL);
+
+    for (i = 0; i < b.ntests; i++) {
+        t = &b.tests[i];
+        count[t->result]++;
+        printf("[ %s ] %s", result_names[t->result], t->bin);
+        if (t->result == TEST_FAIL)
+            printf(": %s differs from %s at line %d",
+                   t->report, t->expected, t->line);
+        else if (t->result == TEST_ERR)
+            printf(": %s", t->why);
+        printf("\n");
+        free(t->bin);
+        free(t->expected);
+        free(t->report);
+    }
+    printf("%d tests: %d passed, %d failed, %d errors, %d without expected"
+           " output\n", b.ntests, count[TEST_PASS], count[TEST_FAIL],
+           count[TEST_ERR], count[TEST_NEW]);
+
+    pthread_mutex_destroy(&b.lock);
+    free(tid);
+    free(b.tests);
+    return count[TEST_FAIL] || count[TEST_ERR];
+}
@@ -0,0 +1,760 @@
+/* Y86 to x86-64 translator for the y86sim "jit" engine */
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "y86sim.h"
+
+#ifdef HAS_JIT
+
+#define JIT_HOT 16              /* interpret a block this often, then translate */
+#define JIT_BUF_SIZE (4<<20)
+#define JIT_BLOCK_MAX 16384     /* upper bound on the code of one block */
+
+/* trampolines at the start of jit_buf */
+#define JIT_ENTER 0
+#define JIT_EXIT  64
+#define JIT_LINK  128
+#define JIT_START 192
+
+/*
+ * Guest state while translated code runs. Inside translated code
+ *     %r8d..%r15d: Y86 %eax..%edi
+ *     %rbx: guest page directory, %rbp: the jit_ctx_t
+ *     %esi: guest CC as 'lahf; seto %al' leave it in %ax
+ *     %edi: steps left
+ *     %rax, %rcx, %rdx: scratch
+ * The host flags hold the guest CC only between an ALU instruction and
+ * the next instruction that clobbers them; %esi is always up to date.
+ */
+typedef struct jit_ctx {
+    long_t reg[REG_CNT];
+    long_t flags;
+    long_t budget;
+    long_t pc;
+    page_tab_t **dir;
+    byte_t *link;       /* EXIT_LINK: the exit site to chain */
+} jit_ctx_t;
+
+typedef int (*jit_enter_t)(jit_ctx_t *ctx, byte_t *code);
+
+/* why translated code returned (value of %eax) */
+typedef enum { EXIT_PC, EXIT_LINK, EXIT_SLOW, EXIT_SMC } exit_t;
+
+/* x86-64 registers and condition codes */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { X_O = 0x0, X_E = 0x4, X_NE = 0x5, X_A = 0x7,
+    X_L = 0xC, X_GE = 0xD, X_LE = 0xE, X_G = 0xF };
+
+#define HREG(_r) (R8 + (_r))
+
+/* a direct exit: 'jmp' (chained later) ; movl $pc, PC(%rbp) ; call link */
+#define SITE_LEN 17
+
+/* code emitted after the block body */
+typedef enum { STUB_EXIT, STUB_SUBOF } stub_kind_t;
+
+typedef struct stub {
+    stub_kind_t kind;
+    byte_t *jcc[4];     /* rel32s jumping to the stub */
+    int njcc;
+    exit_t reason;      /* STUB_EXIT */
+    long_t pc;
+    int refund;         /* steps counted by the block but not executed */
+    int ra, rb;         /* STUB_SUBOF: host registers of 'subl' */
+    byte_t *back;
+} stub_t;
+
+typedef struct jit {
+    byte_t *buf;
+    byte_t *p;
+    mem_t *m;
+    icache_t *ic;
+    bool_t host_cc;     /* the host flags hold the guest CC */
+    stub_t stubs[2*BLOCK_MAX+1];
+    int nstubs;
+} jit_t;
+
+static void emit1(jit_t *j, int b)
+{
+    *j->p++ = b;
+}
+
+static void emit4(jit_t *j, long_t v)
+{
+    memcpy(j->p, &v, 4);
+    j->p += 4;
+}
+
+static void emit8(jit_t *j, void *v)
+{
+    memcpy(j->p, &v, 8);
+    j->p += 8;
+}
+
+static void patch4(byte_t *at, byte_t *target)
+{
+    long_t rel = target - (at + 4);
+    memcpy(at, &rel, 4);
+}
+
+/* REX prefix, if needed, for 'reg' in ModRM.reg and 'rm' in ModRM.rm */
+static void rex(jit_t *j, int w, int reg, int rm)
+{
+    int r = (w ? 8 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+    if (r)
+        emit1(j, 0x40 | r);
+}
+
+static void modrm(jit_t *j, int mod, int reg, int rm)
+{
+    emit1(j, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* op r/m32, r32 with a register operand */
+static void op_rr(jit_t *j, int op, int rm, int reg)
+{
+    rex(j, 0, reg, rm);
+    emit1(j, op);
+    modrm(j, 3, reg, rm);
+}
+
+/* op r32, disp8(%rbp) or the reverse, on a jit_ctx_t field */
+static void op_ctx(jit_t *j, int w, int op, int reg, int off)
+{
+    rex(j, w, reg, RBP);
+    emit1(j, op);
+    modrm(j, 1, reg, RBP);
+    emit1(j, off);
+}
+
+/* op r32, (%rcx) or the reverse, on guest memory (see emit_walk()) */
+static void op_mem(jit_t *j, int op, int reg)
+{
+    rex(j, 0, reg, RCX);
+    emit1(j, op);
+    modrm(j, 0, reg, RCX);
+}
+
+static void mov_imm(jit_t *j, int r, long_t imm)
+{
+    rex(j, 0, 0, r);
+    emit1(j, 0xB8 + (r & 7));
+    emit4(j, imm);
+}
+
+/* lea disp32(base), dst */
+static void lea(jit_t *j, int dst, int base, long_t disp)
+{
+    rex(j, 0, dst, base);
+    emit1(j, 0x8D);
+    modrm(j, 2, dst, base);
+    if ((base & 7) == RSP)
+        emit1(j, 0x24);
+    emit4(j, disp);
+}
+
+static void shr_imm(jit_t *j, int r, int n)
+{
+    rex(j, 0, 0, r);
+    emit1(j, 0xC1);
+    modrm(j, 3, 5, r);
+    emit1(j, n);
+}
+
+static void and_imm(jit_t *j, int r, long_t imm)
+{
+    rex(j, 0, 0, r);
+    emit1(j, 0x81);
+    modrm(j, 3, 4, r);
+    emit4(j, imm);
+}
+
+static void cmp_imm(jit_t *j, int r, long_t imm)
+{
+    rex(j, 0, 0, r);
+    emit1(j, 0x81);
+    modrm(j, 3, 7, r);
+    emit4(j, imm);
+}
+
+static byte_t *jcc(jit_t *j, int cc)
+{
+    emit1(j, 0x0F);
+    emit1(j, 0x80 + cc);
+    emit4(j, 0);
+    return j->p - 4;
+}
+
+static void jmp(jit_t *j, byte_t *target)
+{
+    emit1(j, 0xE9);
+    emit4(j, 0);
+    patch4(j->p - 4, target);
+}
+
+static stub_t *add_stub(jit_t *j, byte_t *jcc, exit_t reason, long_t pc,
+                        int refund)
+{
+    stub_t *s = &j->stubs[j->nstubs++];
+    s->kind = STUB_EXIT;
+    s->jcc[0] = jcc;
+    s->njcc = 1;
+    s->reason = reason;
+    s->pc = pc;
+    s->refund = refund;
+    return s;
+}
+
+/* one more jump to stub 's' */
+static void stub_jcc(stub_t *s, byte_t *jcc)
+{
+    assert(s->njcc < 4);
+    s->jcc[s->njcc++] = jcc;
+}
+
+/* leave translated code: return 'reason' with PC = 'pc' */
+static void emit_exit(jit_t *j, exit_t reason, long_t pc, int refund)
+{
+    if (refund) {
+        emit1(j, 0x81);     /* addl $refund, %edi */
+        modrm(j, 3, 0, RDI);
+        emit4(j, refund);
+    }
+    emit1(j, 0xC7);         /* movl $pc, PC(%rbp) */
+    modrm(j, 1, 0, RBP);
+    emit1(j, offsetof(jit_ctx_t, pc));
+    emit4(j, pc);
+    mov_imm(j, RAX, reason);
+    jmp(j, j->buf + JIT_EXIT);
+}
+
+/* direct exit to 'pc', chained to its block once that is translated */
+static void emit_site(jit_t *j, long_t pc)
+{
+    jmp(j, j->p + 5);
+    emit1(j, 0xC7);
+    modrm(j, 1, 0, RBP);
+    emit1(j, offsetof(jit_ctx_t, pc));
+    emit4(j, pc);
+    emit1(j, 0xE8);         /* call link */
+    emit4(j, 0);
+    patch4(j->p - 4, j->buf + JIT_LINK);
+}
+
+/* indirect exit to the pc in %ecx: look for a translated block first */
+static void emit_indirect(jit_t *j)
+{
+    byte_t *miss[3];
+
+    op_ctx(j, 0, 0x89, RCX, offsetof(jit_ctx_t, pc));
+    op_rr(j, 0x89, RAX, RCX);
+    emit1(j, 0x25);         /* andl $mask, %eax */
+    emit4(j, ICACHE_SIZE-1);
+    emit1(j, 0x48);         /* movabs $tab, %rdx */
+    emit1(j, 0xBA);
+    emit8(j, j->ic->tab);
+    emit1(j, 0x48);         /* mov (%rdx,%rax,8), %rdx */
+    emit1(j, 0x8B);
+    emit1(j, 0x14);
+    emit1(j, 0xC2);
+    emit1(j, 0x48);         /* test %rdx, %rdx */
+    emit1(j, 0x85);
+    emit1(j, 0xD2);
+    miss[0] = jcc(j, X_E);
+    emit1(j, 0x39);         /* cmp %ecx, pc(%rdx) */
+    modrm(j, 1, RCX, RDX);
+    emit1(j, offsetof(block_t, pc));
+    miss[1] = jcc(j, X_NE);
+    emit1(j, 0x48);         /* mov jit(%rdx), %rdx */
+    emit1(j, 0x8B);
+    modrm(j, 1, RDX, RDX);
+    emit1(j, offsetof(block_t, jit));
+    emit1(j, 0x48);
+    emit1(j, 0x85);
+    emit1(j, 0xD2);
+    miss[2] = jcc(j, X_E);
+    emit1(j, 0xFF);         /* jmp *%rdx */
+    emit1(j, 0xE2);
+    patch4(miss[0], j->p);
+    patch4(miss[1], j->p);
+    patch4(miss[2], j->p);
+    mov_imm(j, RAX, EXIT_PC);
+    jmp(j, j->buf + JIT_EXIT);
+}
+
+/* copy the guest CC from the host flags to %esi */
+static void save_cc(jit_t *j)
+{
+    emit1(j, 0x9F);         /* lahf */
+    emit1(j, 0x0F);         /* seto %al */
+    emit1(j, 0x90);
+    emit1(j, 0xC0);
+    op_rr(j, 0x89, RSI, RAX);
+    j->host_cc = TRUE;
+}
+
+/* make sure the host flags hold the guest CC */
+static void load_cc(jit_t *j)
+{
+    if (j->host_cc)
+        return;
+    op_rr(j, 0x89, RAX, RSI);
+    emit1(j, 0x04);         /* add $0x7f, %al: OF = saved OF */
+    emit1(j, 0x7F);
+    emit1(j, 0x9E);         /* sahf */
+    j->host_cc = TRUE;
+}
+
+/* host register holding guest register 'r' (no register reads as 0) */
+static int src_reg(jit_t *j, int r, int scratch)
+{
+    if (NORM_REG(r))
+        return HREG(r);
+    mov_imm(j, scratch, 0);
+    return scratch;
+}
+
+/* mov (%rbx,%rdx,8), %rdx: the page table of guest %eax >> 22 */
+static void emit_tab(jit_t *j)
+{
+    op_rr(j, 0x89, RDX, RAX);
+    shr_imm(j, RDX, TAB_BITS+PAGE_BITS);
+    emit1(j, 0x48);
+    emit1(j, 0x8B);
+    emit1(j, 0x14);
+    emit1(j, 0xD3);
+}
+
+/*
+ * emit_walk: %rcx = host address of the guest long at %eax, through its
+ *     page in the 'rd' (loads) or 'wr' (stores) page table entries; leave
+ *     for nexti() if the long is invalid, crosses a page or is unmapped
+ */
+static void emit_walk(jit_t *j, int entries, long_t pc, int refund)
+{
+    stub_t *s;
+
+    cmp_imm(j, RAX, (long_t)(j->m->len - 4));
+    s = add_stub(j, jcc(j, X_A), EXIT_SLOW, pc, refund);
+    emit_tab(j);
+    emit1(j, 0x48);         /* test %rdx, %rdx */
+    emit1(j, 0x85);
+    emit1(j, 0xD2);
+    stub_jcc(s, jcc(j, X_E));
+    op_rr(j, 0x89, RCX, RAX);
+    shr_imm(j, RCX, PAGE_BITS);
+    and_imm(j, RCX, TAB_SIZE-1);
+    emit1(j, 0x48);         /* mov entries(%rdx,%rcx,8), %rcx */
+    emit1(j, 0x8B);
+    emit1(j, 0x8C);
+    emit1(j, 0xCA);
+    emit4(j, entries);
+    emit1(j, 0x48);         /* test %rcx, %rcx */
+    emit1(j, 0x85);
+    emit1(j, 0xC9);
+    stub_jcc(s, jcc(j, X_E));
+    op_rr(j, 0x89, RDX, RAX);
+    and_imm(j, RDX, PAGE_SIZE-1);
+    cmp_imm(j, RDX, PAGE_SIZE-4);
+    stub_jcc(s, jcc(j, X_A));
+    emit1(j, 0x48);         /* add %rdx, %rcx */
+    emit1(j, 0x01);
+    emit1(j, 0xD1);
+    j->host_cc = FALSE;
+}
+
+/* %eax = disp + guest register 'rb', then walk to it as emit_walk() */
+static void emit_addr(jit_t *j, int rb, long_t disp, int entries,
+                      uop_t *u, int refund)
+{
+    if (NORM_REG(rb))
+        lea(j, RAX, HREG(rb), disp);
+    else
+        mov_imm(j, RAX, disp);
+    emit_walk(j, entries, u->pc, refund);
+}
+
+/* after a store to guest %eax: leave if it hit decoded code */
+static void emit_smc_check(jit_t *j, long_t pc, int refund)
+{
+    int shift = 0;
+    while ((1 << shift) < BLK_SIZE)
+        shift++;
+
+    emit_tab(j);
+    emit1(j, 0x25);         /* and $TAB_SPAN-1, %eax */
+    emit4(j, TAB_SPAN-1);
+    lea(j, RCX, RAX, 3);
+    shr_imm(j, RCX, shift);
+    shr_imm(j, RAX, shift);
+    emit1(j, 0x8A);         /* mov code(%rdx,%rcx), %cl */
+    emit1(j, 0x8C);
+    emit1(j, 0x0A);
+    emit4(j, offsetof(page_tab_t, code));
+    emit1(j, 0x0A);         /* or code(%rdx,%rax), %cl */
+    emit1(j, 0x8C);
+    emit1(j, 0x02);
+    emit4(j, offsetof(page_tab_t, code));
+    add_stub(j, jcc(j, X_NE), EXIT_SMC, pc, refund);
+}
+
+static int x86_cond(int ifun)
+{
+    static int cc[] = { 0, X_LE, X_L, X_E, X_NE, X_GE, X_G };
+    return cc[ifun];
+}
+
+/* translate one uop; 'left' is the number of uops after it */
+static void jit_uop(jit_t *j, uop_t *u, int left)
+{
+    int src;
+    stub_t *s;
+    static int alu_op[] = { 0x01, 0x29, 0x21, 0x31 };
+    byte_t *taken;
+
+    switch (u->icode) {
+        case I_NOP:
+            break;
+        case I_RRMOVL:
+            if (u->ifun == C_YES) {
+                if (NORM_REG(u->ra))
+                    op_rr(j, 0x89, HREG(u->rb), HREG(u->ra));
+                else
+                    mov_imm(j, HREG(u->rb), 0);
+                break;
+            }
+            load_cc(j);
+            src = src_reg(j, u->ra, RAX);
+            rex(j, 0, HREG(u->rb), src);    /* cmovcc src, rb */
+            emit1(j, 0x0F);
+            emit1(j, 0x40 + x86_cond(u->ifun));
+            modrm(j, 3, HREG(u->rb), src);
+            break;
+        case I_IRMOVL:
+            mov_imm(j, HREG(u->rb), u->valC);
+            break;
+        case I_RMMOVL:
+            emit_addr(j, u->rb, u->valC, offsetof(page_tab_t, wr),
+                      u, left + 1);
+            op_mem(j, 0x89, src_reg(j, u->ra, RDX));
+            emit_smc_check(j, u->next_pc, left);
+            break;
+        case I_MRMOVL:
+            emit_addr(j, u->rb, u->valC, offsetof(page_tab_t, rd),
+                      u, left + 1);
+            op_mem(j, 0x8B, HREG(u->ra));
+            break;
+        case I_ALU:
+            src = src_reg(j, u->ra, RAX);
+            op_rr(j, alu_op[u->ifun], HREG(u->rb), src);
+            if (u->ifun == A_SUB && src != RAX) {
+                /* compute_cc() differs from x86 for 0 - 0x80000000 */
+                s = &j->stubs[j->nstubs++];
+                s->kind = STUB_SUBOF;
+                s->jcc[0] = jcc(j, X_O);
+                s->njcc = 1;
+                s->ra = src;
+                s->rb = HREG(u->rb);
+                s->back = j->p;
+            }
+            save_cc(j);
+            break;
+        case I_JMP:
+            if (u->ifun == C_YES) {
+                emit_site(j, u->valC);
+                break;
+            }
+            load_cc(j);
+            taken = jcc(j, x86_cond(u->ifun));
+            emit_site(j, u->next_pc);
+            patch4(taken, j->p);
+            emit_site(j, u->valC);
+            break;
+        case I_CALL:
+            lea(j, RAX, HREG(REG_ESP), -4);
+            emit_walk(j, offsetof(page_tab_t, wr), u->pc, left + 1);
+            emit1(j, 0xC7);     /* movl $next_pc, (%rcx) */
+            modrm(j, 0, 0, RCX);
+            emit4(j, u->next_pc);
+            op_rr(j, 0x89, HREG(REG_ESP), RAX);
+            emit_smc_check(j, u->valC, left);
+            emit_site(j, u->valC);
+            break;
+        case I_RET:
+            op_rr(j, 0x89, RAX, HREG(REG_ESP));
+            emit_walk(j, offsetof(page_tab_t, rd), u->pc, left + 1);
+            op_mem(j, 0x8B, RCX);
+            lea(j, HREG(REG_ESP), HREG(REG_ESP), 4);
+            emit_indirect(j);
+            break;
+        case I_PUSHL:
+            lea(j, RAX, HREG(REG_ESP), -4);
+            emit_walk(j, offsetof(page_tab_t, wr), u->pc, left + 1);
+            op_mem(j, 0x89, src_reg(j, u->ra, RDX));
+            op_rr(j, 0x89, HREG(REG_ESP), RAX);
+            emit_smc_check(j, u->next_pc, left);
+            break;
+        case I_POPL:
+            op_rr(j, 0x89, RAX, HREG(REG_ESP));
+            emit_walk(j, offsetof(page_tab_t, rd), u->pc, left + 1);
+            op_mem(j, 0x8B, RCX);
+            lea(j, HREG(REG_ESP), HREG(REG_ESP), 4);
+            op_rr(j, 0x89, HREG(u->ra), RCX);
+            break;
+        case U_END:
+            emit_site(j, u->pc);
+            break;
+        default:
+            emit_exit(j, EXIT_SLOW, u->pc, left + 1);
+            break;
+    }
+}
+
+static void jit_stub(jit_t *j, stub_t *s)
+{
+    byte_t *jne[2];
+    int i;
+
+    for (i = 0; i < s->njcc; i++)
+        patch4(s->jcc[i], j->p);
+    if (s->kind == STUB_EXIT) {
+        emit_exit(j, s->reason, s->pc, s->refund);
+        return;
+    }
+
+    /* OF is set: compute_cc() says Z=0 S=1 O=0 when rB was 0 */
+    cmp_imm(j, s->ra, 0x80000000);
+    emit1(j, 0x75);
+    jne[0] = j->p++;
+    cmp_imm(j, s->rb, 0x80000000);
+    emit1(j, 0x75);
+    jne[1] = j->p++;
+    op_rr(j, 0x85, s->rb, s->rb);
+    jmp(j, s->back);
+    for (i = 0; i < 2; i++)
+        *jne[i] = j->p - (jne[i] + 1);
+    /* otherwise redo the subtraction to get the flags back */
+    op_rr(j, 0x89, RAX, s->rb);
+    op_rr(j, 0x01, RAX, s->ra);
+    op_rr(j, 0x29, RAX, s->ra);
+    jmp(j, s->back);
+}
+
+/*
+ * jit_block: translate block 'b' into jit_buf
+ *     when jit_buf is full the whole cache is flushed instead,
+ *     and 'b' must not be used any more
+ */
+static void jit_block(y86sim_t *sim, block_t *b)
+{
+    icache_t *ic = sim->ic;
+    jit_t *j;
+    byte_t *start;
+    int i;
+
+    if (ic->jit_used + JIT_BLOCK_MAX > ic->jit_size) {
+        icache_flush(sim);
+        return;
+    }
+
+    j = (jit_t *)malloc(sizeof(jit_t));
+    j->buf = ic->jit_buf;
+    j->p = start = ic->jit_buf + ic->jit_used;
+    j->m = sim->m;
+    j->ic = ic;
+    j->host_cc = FALSE;
+    j->nstubs = 0;
+
+    /* subl $len, %edi ; jl out-of-steps */
+    emit1(j, 0x81);
+    modrm(j, 3, 5, RDI);
+    emit4(j, b->len);
+    add_stub(j, jcc(j, X_L), EXIT_PC, b->pc, b->len);
+
+    for (i = 0; i < b->len; i++)
+        jit_uop(j, &b->uops[i], b->len - i - 1);
+    switch (b->uops[b->len-1].icode) {
+        case I_JMP: case I_CALL: case I_RET: case U_SLOW:
+            break;
+        default:
+            jit_uop(j, &b->uops[b->len], 0);
+    }
+    for (i = 0; i < j->nstubs; i++)
+        jit_stub(j, &j->stubs[i]);
+
+    assert(j->p - start <= JIT_BLOCK_MAX);
+    b->jit = start;
+    ic->jit_used = j->p - ic->jit_buf;
+    free(j);
+}
+
+/* jit_init: map jit_buf and write the trampolines */
+static int jit_init(icache_t *ic)
+{
+    jit_t j;
+    int i;
+
+    ic->jit_buf = mmap(NULL, JIT_BUF_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
+                       MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ic->jit_buf == MAP_FAILED) {
+        ic->jit_buf = NULL;
+        return -1;
+    }
+    ic->jit_size = JIT_BUF_SIZE;
+    ic->jit_start = ic->jit_used = JIT_START;
+    j.buf = ic->jit_buf;
+
+    /* int enter(jit_ctx_t *ctx, byte_t *code) */
+    j.p = j.buf + JIT_ENTER;
+    emit1(&j, 0x53);                        /* push %rbx, %rbp, %r12-%r15 */
+    emit1(&j, 0x55);
+    for (i = R12; i <= R15; i++) {
+        emit1(&j, 0x41);
+        emit1(&j, 0x50 + (i & 7));
+    }
+    rex(&j, 1, RDI, RBP);                   /* mov %rdi, %rbp */
+    emit1(&j, 0x89);
+    modrm(&j, 3, RDI, RBP);
+    rex(&j, 1, RSI, RAX);                   /* mov %rsi, %rax */
+    emit1(&j, 0x89);
+    modrm(&j, 3, RSI, RAX);
+    op_ctx(&j, 1, 0x8B, RBX, offsetof(jit_ctx_t, dir));
+    for (i = 0; i < REG_CNT; i++)
+        op_ctx(&j, 0, 0x8B, HREG(i), offsetof(jit_ctx_t, reg) + 4*i);
+    op_ctx(&j, 0, 0x8B, RSI, offsetof(jit_ctx_t, flags));
+    op_ctx(&j, 0, 0x8B, RDI, offsetof(jit_ctx_t, budget));
+    emit1(&j, 0xFF);                        /* jmp *%rax */
+    emit1(&j, 0xE0);
+    assert(j.p <= j.buf + JIT_EXIT);
+
+    /* exit: save the guest state, return %eax */
+    j.p = j.buf + JIT_EXIT;
+    for (i = 0; i < REG_CNT; i++)
+        op_ctx(&j, 0, 0x89, HREG(i), offsetof(jit_ctx_t, reg) + 4*i);
+    op_ctx(&j, 0, 0x89, RSI, offsetof(jit_ctx_t, flags));
+    op_ctx(&j, 0, 0x89, RDI, offsetof(jit_ctx_t, budget));
+    for (i = R15; i >= R12; i--) {
+        emit1(&j, 0x41);
+        emit1(&j, 0x58 + (i & 7));
+    }
+    emit1(&j, 0x5D);
+    emit1(&j, 0x5B);
+    emit1(&j, 0xC3);                        /* ret */
+    assert(j.p <= j.buf + JIT_LINK);
+
+    /* link: called from an exit site, which is remembered for chaining */
+    j.p = j.buf + JIT_LINK;
+    emit1(&j, 0x59);                        /* pop %rcx */
+    emit1(&j, 0x48);                        /* sub $SITE_LEN, %rcx */
+    emit1(&j, 0x83);
+    modrm(&j, 3, 5, RCX);
+    emit1(&j, SITE_LEN);
+    op_ctx(&j, 1, 0x89, RCX, offsetof(jit_ctx_t, link));
+    mov_imm(&j, RAX, EXIT_LINK);
+    jmp(&j, j.buf + JIT_EXIT);
+    assert(j.p <= j.buf + JIT_START);
+    return 0;
+}
+
+void jit_free(icache_t *ic)
+{
+    if (ic->jit_buf)
+        munmap(ic->jit_buf, ic->jit_size);
+}
+
+static void ctx_load(jit_ctx_t *ctx, y86sim_t *sim)
+{
+    int i;
+    cc_t cc = get_cc(sim);
+
+    for (i = 0; i < REG_CNT; i++)
+        ctx->reg[i] = get_reg_val(sim->r, i);
+    ctx->flags = GET_SF(cc) << 15 | GET_ZF(cc) << 14 | GET_OF(cc);
+    ctx->pc = sim->pc;
+    ctx->dir = sim->m->dir;
+}
+
+static void ctx_store(jit_ctx_t *ctx, y86sim_t *sim)
+{
+    int i;
+    for (i = 0; i < REG_CNT; i++)
+        set_reg_val(sim->r, i, ctx->reg[i]);
+    set_cc(sim, PACK_CC((ctx->flags >> 14) & 1, (ctx->flags >> 15) & 1,
+                        ctx->flags & 1));
+    sim->pc = ctx->pc;
+}
+
+/* chain the exit site 'site' to the translated block at 'pc', if any */
+static void jit_link(icache_t *ic, byte_t *site, long_t pc)
+{
+    block_t *b = ic->tab[pc & (ICACHE_SIZE-1)];
+    if (b && b->pc == pc && b->jit)
+        patch4(site + 1, b->jit);
+}
+
+/*
+ * run_jit: interpret blocks with the switch engine until they are hot,
+ *     then run their x86-64 translation (same arguments as nexti() loop
+ *     engines, see y86run.h)
+ */
+stat_t run_jit(y86sim_t *sim, int max_steps, int *steps)
+{
+    icache_t *ic;
+    jit_ctx_t ctx;
+    jit_enter_t enter;
+    block_t *b;
+    stat_t e = STAT_AOK;
+    int step = 0, n;
+    exit_t reason;
+
+    icache_init(sim);
+    ic = sim->ic;
+    if (!ic->jit_buf && jit_init(ic) < 0)
+        return run_switch(sim, max_steps, steps);
+    enter = (jit_enter_t)(ic->jit_buf + JIT_ENTER);
+
+    while (step < max_steps && e == STAT_AOK) {
+        b = find_block(sim, sim->pc, NULL);
+        if (!b->jit && b->hits++ >= JIT_HOT) {
+            jit_block(sim, b);
+            if (!b->jit)
+                continue;   /* jit_buf was full and got flushed */
+        }
+        if (!b->jit || b->len > max_steps - step) {
+            n = b->len < max_steps - step ? b->len : max_steps - step;
+            e = run_switch(sim, n, &n);
+            step += n;
+            continue;
+        }
+
+        ctx_load(&ctx, sim);
+        ctx.budget = max_steps - step;
+        reason = enter(&ctx, b->jit);
+        step = max_steps - ctx.budget;
+        ctx_store(&ctx, sim);
+
+        switch (reason) {
+            case EXIT_LINK:
+                jit_link(ic, ctx.link, ctx.pc);
+                break;
+            case EXIT_SLOW:
+                e = nexti(sim);
+                step++;
+                if (sim->m->smc)
+                    icache_flush(sim);
+                break;
+            case EXIT_SMC:
+                icache_flush(sim);
+                break;
+            case EXIT_PC:
+                break;
+        }
+    }
+
+    *steps = step;
+    return e;
+}
+
+#endif
@@ -0,0 +1,296 @@
+/* Instruction-level profile for the y86sim "-p" option */
+
+#include "y86sim.h"
+
+#define PROF_TOP 20         /* rows of each table in the report */
+#define LINE_SIZE 1024
+
+/* one executed instruction address */
+typedef struct prof_pc {
+    long_t pc;
+    byte_t code;        /* icode:ifun when last executed */
+    bool_t used;
+    unsigned count;
+    unsigned taken;     /* conditional jumps only */
+    unsigned not_taken;
+} prof_pc_t;
+
+/* one PROF_RANGE-byte range of memory */
+typedef struct prof_mem {
+    long_t base;
+    bool_t used;
+    unsigned reads;
+    unsigned writes;
+} prof_mem_t;
+
+struct prof {
+    prof_pc_t *pcs;     /* open addressing, pc_size is a power of 2 */
+    int pc_size;
+    int npcs;
+    prof_mem_t *mems;
+    int mem_size;
+    int nmems;
+    unsigned ops[256];  /* per icode:ifun */
+    unsigned steps;
+};
+
+prof_t *prof_new(void)
+{
+    prof_t *p = (prof_t *)calloc(1, sizeof(prof_t));
+    p->pc_size = p->mem_size = 256;
+    p->pcs = (prof_pc_t *)calloc(p->pc_size, sizeof(prof_pc_t));
+    p->mems = (prof_mem_t *)calloc(p->mem_size, sizeof(prof_mem_t));
+    return p;
+}
+
+void prof_free(prof_t *p)
+{
+    free((void *) p->pcs);
+    free((void *) p->mems);
+    free((void *) p);
+}
+
+static unsigned hash(long_t key)
+{
+    return (unsigned)key * 2654435761u;
+}
+
+/* the entry of 'pc', added if new */
+static prof_pc_t *find_pc(prof_t *p, long_t pc)
+{
+    prof_pc_t *old;
+    int i, n;
+
+    if (4 * (p->npcs + 1) > 3 * p->pc_size) {
+        /* keep the table at most 3/4 full */
+        old = p->pcs;
+        n = p->pc_size;
+        p->pc_size *= 2;
+        p->pcs = (prof_pc_t *)calloc(p->pc_size, sizeof(prof_pc_t));
+        for (i = 0; i < n; i++)
+            if (old[i].used)
+                *find_pc(p, old[i].pc) = old[i];
+        free((void *) old);
+    }
+    for (i = hash(pc) & (p->pc_size-1); p->pcs[i].used;
+         i = (i+1) & (p->pc_size-1))
+        if (p->pcs[i].pc == pc)
+            return &p->pcs[i];
+    p->npcs++;
+    p->pcs[i].used = TRUE;
+    p->pcs[i].pc = pc;
+    return &p->pcs[i];
+}
+
+/* the entry of the range holding 'addr', added if new */
+static prof_mem_t *find_mem(prof_t *p, long_t addr)
+{
+    long_t base = addr & ~(PROF_RANGE-1);
+    prof_mem_t *old;
+    int i, n;
+
+    if (4 * (p->nmems + 1) > 3 * p->mem_size) {
+        old = p->mems;
+        n = p->mem_size;
+        p->mem_size *= 2;
+        p->mems = (prof_mem_t *)calloc(p->mem_size, sizeof(prof_mem_t));
+        for (i = 0; i < n; i++)
+            if (old[i].used)
+                *find_mem(p, old[i].base) = old[i];
+        free((void *) old);
+    }
+    for (i = hash(base) & (p->mem_size-1); p->mems[i].used;
+         i = (i+1) & (p->mem_size-1))
+        if (p->mems[i].base == base)
+            return &p->mems[i];
+    p->nmems++;
+    p->mems[i].used = TRUE;
+    p->mems[i].base = base;
+    return &p->mems[i];
+}
+
+/* an execution of the instruction at 'pc', whose first byte is 'code' */
+void prof_exec(prof_t *p, long_t pc, byte_t code)
+{
+    prof_pc_t *e = find_pc(p, pc);
+    e->code = code;
+    e->count++;
+    p->ops[code]++;
+    p->steps++;
+}
+
+/* the conditional jump at 'pc' was (not) taken */
+void prof_jump(prof_t *p, long_t pc, bool_t taken)
+{
+    prof_pc_t *e = find_pc(p, pc);
+    if (taken)
+        e->taken++;
+    else
+        e->not_taken++;
+}
+
+/* a long was read or written at 'addr' */
+void prof_mem(prof_t *p, long_t addr, bool_t write)
+{
+    prof_mem_t *e = find_mem(p, addr);
+    if (write)
+        e->writes++;
+    else
+        e->reads++;
+}
+
+/* assembly name of icode:ifun 'code' */
+static char *op_name(byte_t code, char *buf)
+{
+    static char *names[] = { "halt", "nop", "rrmovl", "irmovl", "rmmovl",
+        "mrmovl", "", "", "call", "ret", "pushl", "popl" };
+    static char *alu[] = { "addl", "subl", "andl", "xorl" };
+    static char *cond[] = { "", "le", "l", "e", "ne", "ge", "g" };
+    int icode = HIGH(code), ifun = LOW(code);
+
+    if (icode == I_ALU && ifun <= A_XOR)
+        return alu[ifun];
+    if (icode == I_JMP && ifun <= C_G)
+        sprintf(buf, "j%s", ifun == C_YES ? "mp" : cond[ifun]);
+    else if (icode == I_RRMOVL && ifun > C_YES && ifun <= C_G)
+        sprintf(buf, "cmov%s", cond[ifun]);
+    else if (icode <= I_POPL && *names[icode] && (ifun == 0))
+        return names[icode];
+    else
+        sprintf(buf, "(bad %.2x)", code);
+    return buf;
+}
+
+/* a line of the assembler listing */
+typedef struct listing {
+    long_t addr;
+    int lineno;
+    char *text;
+} listing_t;
+
+/*
+ * load_listing: read the instruction lines of the .yo listing of 'bin'
+ *     (listing line n is line n of the .ys file)
+ *
+ * return
+ *     the number of lines read into *lines, 0 if there is no listing
+ */
+static int load_listing(char *bin, listing_t **lines)
+{
+    char line[LINE_SIZE], bytes[LINE_SIZE];
+    char *yo = strdup(bin), *src;
+    FILE *f;
+    unsigned addr;
+    int n = 0, size = 0, lineno = 0;
+
+    strcpy(yo + strlen(yo) - 4, ".yo");
+    f = fopen(yo, "r");
+    free(yo);
+    *lines = NULL;
+    if (!f)
+        return 0;
+    while (fgets(line, LINE_SIZE, f)) {
+        lineno++;
+        src = strchr(line, '|');
+        if (!src || sscanf(line, " 0x%x: %[0-9a-fA-F]", &addr, bytes) != 2)
+            continue;
+        if (n == size) {
+            size = size ? 2*size : 64;
+            *lines = (listing_t *)realloc(*lines, size * sizeof(listing_t));
+        }
+        for (src++; *src == ' ' || *src == '\t'; src++)
+            ;
+        src[strcspn(src, "\r\n")] = '\0';
+        (*lines)[n].addr = addr;
+        (*lines)[n].lineno = lineno;
+        (*lines)[n].text = strdup(src);
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+static int by_count(const void *a, const void *b)
+{
+    const prof_pc_t *x = a, *y = b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+static int by_traffic(const void *a, const void *b)
+{
+    const prof_mem_t *x = a, *y = b;
+    unsigned tx = x->reads + x->writes, ty = y->reads + y->writes;
+    if (tx != ty)
+        return tx < ty ? 1 : -1;
+    return x->base < y->base ? -1 : x->base > y->base;
+}
+
+static double percent(unsigned n, unsigned total)
+{
+    return total ? 100.0 * n / total : 0;
+}
+
+/*
+ * prof_report: print the hottest instructions, the opcode mix and the
+ *     busiest memory ranges; instructions are annotated with their .ys
+ *     line when file.yo is found next to 'bin'
+ */
+void prof_report(prof_t *p, char *bin, FILE *out)
+{
+    listing_t *lines;
+    int nlines = load_listing(bin, &lines);
+    prof_pc_t *pcs = (prof_pc_t *)malloc(p->npcs * sizeof(prof_pc_t));
+    prof_mem_t *mems = (prof_mem_t *)malloc(p->nmems * sizeof(prof_mem_t));
+    char buf[32], *ys = strdup(bin);
+    int i, j, n;
+
+    strcpy(ys + strlen(ys) - 4, ".ys");
+    for (i = n = 0; i < p->pc_size; i++)
+        if (p->pcs[i].used)
+            pcs[n++] = p->pcs[i];
+    qsort(pcs, n, sizeof(prof_pc_t), by_count);
+
+    fprintf(out, "\nProfile: %u instructions at %d addresses\n",
+            p->steps, p->npcs);
+    fprintf(out, "   count       %%    taken  not-taken  PC      instruction\n");
+    for (i = 0; i < n && i < PROF_TOP; i++) {
+        fprintf(out, "%8u  %5.1f%%", pcs[i].count,
+                percent(pcs[i].count, p->steps));
+        if (pcs[i].taken + pcs[i].not_taken)
+            fprintf(out, "  %7u  %9u", pcs[i].taken, pcs[i].not_taken);
+        else
+            fprintf(out, "  %7s  %9s", "", "");
+        fprintf(out, "  0x%.3x  ", pcs[i].pc);
+        for (j = 0; j < nlines && lines[j].addr != pcs[i].pc; j++)
+            ;
+        if (j < nlines)
+            fprintf(out, "%s:%d: %s\n", ys, lines[j].lineno, lines[j].text);
+        else
+            fprintf(out, "%s\n", op_name(pcs[i].code, buf));
+    }
+
+    fprintf(out, "\nOpcodes:\n");
+    for (i = 0; i < 256; i++)
+        if (p->ops[i])
+            fprintf(out, "%8u  %5.1f%%  %s\n", p->ops[i],
+                    percent(p->ops[i], p->steps), op_name(i, buf));
+
+    for (i = n = 0; i < p->mem_size; i++)
+        if (p->mems[i].used)
+            mems[n++] = p->mems[i];
+    qsort(mems, n, sizeof(prof_mem_t), by_traffic);
+    fprintf(out, "\nMemory (%d-byte ranges):\n", PROF_RANGE);
+    fprintf(out, "   reads    writes  range\n");
+    for (i = 0; i < n && i < PROF_TOP; i++)
+        fprintf(out, "%8u  %8u  0x%.4x-0x%.4x\n", mems[i].reads,
+                mems[i].writes, mems[i].base, mems[i].base + PROF_RANGE-1);
+
+    for (i = 0; i < nlines; i++)
+        free(lines[i].text);
+    free(lines);
+    free(pcs);
+    free(mems);
+    free(ys);
+}
@@ -0,0 +1,226 @@
+/*
+ * y86run.h: body of the decoded-block execution engines
+ *
+ * y86sim.c includes this file once per engine, with
+ *     RUN_NAME: the name of the generated function
+ *     RUN_THREADED: 1 to dispatch through uop->handler (labels as values),
+ *                   0 to dispatch with a switch on uop->icode
+ *     RUN_PROFILE: 1 to record every instruction in sim->prof, 0 to build
+ *                  the engine without any profiling code
+ *
+ * RUN_NAME: execute instructions from the decoded instruction cache
+ * args
+ *     sim: the y86 image with PC, register and memory
+ *     max_steps: the maximum number of instructions to execute
+ *     steps: set to the number of instructions executed, counted as the
+ *            nexti() loop would (including the one that stops execution)
+ *
+ * return
+ *     the status of the last instruction, as nexti()
+ */
+
+#if RUN_THREADED
+#define PSEUDO(_op) op_##_op:
+#define NEXT() goto *(++u)->handler
+#else
+#define PSEUDO(_op) case _op:
+#define NEXT() u++; continue
+#endif
+
+#if RUN_PROFILE
+#define OP(_op) PSEUDO(_op) prof_exec(sim->prof, u->pc, HPACK(_op, u->ifun));
+#define PROF_MEM(_addr, _write) prof_mem(sim->prof, _addr, _write)
+#define PROF_JUMP(_taken) \
+    if (u->ifun != C_YES) prof_jump(sim->prof, u->pc, _taken)
+#define NEXTI(_sim) prof_nexti(_sim)
+#else
+#define OP(_op) PSEUDO(_op)
+#define PROF_MEM(_addr, _write)
+#define PROF_JUMP(_taken)
+#define NEXTI(_sim) nexti(_sim)
+#endif
+
+stat_t RUN_NAME(y86sim_t *sim, int max_steps, int *steps)
+{
+    long_t reg[16];
+    long_t pc = sim->pc;
+    mem_t *m = sim->m;
+    int step = 0;
+    stat_t e = STAT_AOK;
+    block_t *b;
+    uop_t *u;
+    long_t valA, valB, valE, valM;
+#if RUN_THREADED
+    static void *labels[U_END+1] = {
+        [0 ... U_END] = &&op_U_SLOW,
+        [I_NOP] = &&op_I_NOP,
+        [I_RRMOVL] = &&op_I_RRMOVL,
+        [I_IRMOVL] = &&op_I_IRMOVL,
+        [I_RMMOVL] = &&op_I_RMMOVL,
+        [I_MRMOVL] = &&op_I_MRMOVL,
+        [I_ALU] = &&op_I_ALU,
+        [I_JMP] = &&op_I_JMP,
+        [I_CALL] = &&op_I_CALL,
+        [I_RET] = &&op_I_RET,
+        [I_PUSHL] = &&op_I_PUSHL,
+        [I_POPL] = &&op_I_POPL,
+        [U_END] = &&op_U_END,
+    };
+#else
+    void **labels = NULL;
+#endif
+
+    icache_init(sim);
+    load_regs(sim, reg);
+
+    while (step < max_steps) {
+        b = find_block(sim, pc, labels);
+        if (b->len > max_steps - step) {
+            /* too few steps left for the whole block, finish one by one */
+            sim->pc = pc;
+            store_regs(sim, reg);
+            for (; step < max_steps && e == STAT_AOK; step++)
+                e = NEXTI(sim);
+            pc = sim->pc;
+            load_regs(sim, reg);
+            break;
+        }
+        step += b->len;
+        u = b->uops;
+
+#if RUN_THREADED
+        goto *u->handler;
+#else
+        for (;;) switch (u->icode) {
+#endif
+        OP(I_NOP)
+            NEXT();
+        OP(I_RRMOVL)
+            if (cond_doit(get_cc(sim), u->ifun))
+                reg[u->rb] = reg[u->ra];
+            NEXT();
+        OP(I_IRMOVL)
+            reg[u->rb] = u->valC;
+            NEXT();
+        OP(I_RMMOVL)
+            if (!set_long_val(m, reg[u->rb] + u->valC, reg[u->ra]))
+                goto slow;
+            PROF_MEM(reg[u->rb] + u->valC, TRUE);
+            if (m->smc) {
+                pc = u->next_pc;
+                goto smc;
+            }
+            NEXT();
+        OP(I_MRMOVL)
+            if (!get_long_val(m, reg[u->rb] + u->valC, &valM))
+                goto slow;
+            PROF_MEM(reg[u->rb] + u->valC, FALSE);
+            reg[u->ra] = valM;
+            NEXT();
+        OP(I_ALU)
+            valA = reg[u->ra];
+            valB = reg[u->rb];
+            valE = compute_alu(u->ifun, valA, valB);
+            set_cc_lazy(sim, u->ifun, valA, valB, valE);
+            reg[u->rb] = valE;
+            NEXT();
+        OP(I_JMP)
+            if (cond_doit(get_cc(sim), u->ifun)) {
+                PROF_JUMP(TRUE);
+                pc = u->valC;
+            } else {
+                PROF_JUMP(FALSE);
+                pc = u->next_pc;
+            }
+            goto next;
+        OP(I_CALL)
+            valE = reg[REG_ESP] - 4;
+            if (!set_long_val(m, valE, u->next_pc))
+                goto slow;
+            PROF_MEM(valE, TRUE);
+            reg[REG_ESP] = valE;
+            pc = u->valC;
+            if (m->smc)
+                goto smc;
+            goto next;
+        OP(I_RET)
+            if (!get_long_val(m, reg[REG_ESP], &valM))
+                goto slow;
+            PROF_MEM(reg[REG_ESP], FALSE);
+            reg[REG_ESP] += 4;
+            pc = valM;
+            goto next;
+        OP(I_PUSHL)
+            valA = reg[u->ra];
+            valE = reg[REG_ESP] - 4;
+            if (!set_long_val(m, valE, valA))
+                goto slow;
+            PROF_MEM(valE, TRUE);
+            reg[REG_ESP] = valE;
+            if (m->smc) {
+                pc = u->next_pc;
+                goto smc;
+            }
+            NEXT();
+        OP(I_POPL)
+            valA = reg[REG_ESP];
+            if (!get_long_val(m, valA, &valM))
+                goto slow;
+            PROF_MEM(valA, FALSE);
+            reg[REG_ESP] = valA + 4;
+            reg[u->ra] = valM;
+            NEXT();
+        PSEUDO(U_END)
+            /* block was cut at BLOCK_MAX, fall through to the next one */
+            pc = u->pc;
+            goto next;
+        PSEUDO(U_SLOW)
+#if !RUN_THREADED
+        default:
+#endif
+            goto slow;
+#if !RUN_THREADED
+        }
+#endif
+
+smc:
+        /* a store hit decoded code: the rest of this block may be stale */
+        step -= b->len - (u - b->uops) - 1;
+        icache_flush(sim);
+        continue;
+
+slow:
+        /* let nexti() redo this instruction, it reports any fault */
+        step -= b->len - (u - b->uops) - 1;
+        sim->pc = u->pc;
+        store_regs(sim, reg);
+#if RUN_PROFILE
+        /* a faulting uop was already counted, U_SLOW ones are not */
+        e = u->icode == U_SLOW ? prof_nexti(sim) : nexti(sim);
+#else
+        e = nexti(sim);
+#endif
+        pc = sim->pc;
+        load_regs(sim, reg);
+        if (m->smc)
+            icache_flush(sim);
+        if (e != STAT_AOK)
+            break;
+next:
+        ;
+    }
+
+    if (m->smc)
+        icache_flush(sim);
+    sim->pc = pc;
+    store_regs(sim, reg);
+    *steps = step;
+    return e;
+}
+
+#undef PSEUDO
+#undef OP
+#undef NEXT
+#undef PROF_MEM
+#undef PROF_JUMP
+#undef NEXTI
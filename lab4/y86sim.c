@@ -2,14 +2,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "y86sim.h"
 
 #define err_print(_s, _a ...) \
     fprintf(stdout, _s"\n", _a);
 
+/* errors found while running 'sim' go to its report */
+#define sim_err(_sim, _s, _a ...) \
+    fprintf((_sim)->out, _s"\n", _a);
 
-typedef enum {STAT_AOK, STAT_HLT, STAT_ADR, STAT_INS} stat_t;
 
 char *stat_names[] = { "AOK", "HLT", "ADR", "INS" };
 
@@ -39,81 +44,292 @@ char *cc_name(cc_t c)
         return cc_names[c];
 }
 
+/* pages that were never stored to read as zero */
+static byte_t zero_page[PAGE_SIZE];
+
+/* TRUE if the 'n' bytes at 'addr' are inside m (addresses are unsigned) */
+#define IN_MEM(m, addr, n) ((long long)(unsigned)(addr) + (n) <= (m)->len)
+
+#define DIR_IDX(addr) ((unsigned)(addr) >> (TAB_BITS+PAGE_BITS))
+#define TAB_IDX(addr) ((unsigned)(addr) >> PAGE_BITS & (TAB_SIZE-1))
+#define PAGE_OFF(addr) ((unsigned)(addr) & (PAGE_SIZE-1))
+#define CODE_IDX(addr) (((unsigned)(addr) & (TAB_SPAN-1)) / BLK_SIZE)
+
+/* page table covering 'addr', allocated on first use */
+static page_tab_t *get_tab(mem_t *m, long_t addr)
+{
+    page_tab_t **t = &m->dir[DIR_IDX(addr)];
+    if (!*t)
+        *t = (page_tab_t *)calloc(1, sizeof(page_tab_t));
+    return *t;
+}
+
+/* new page holding a copy of 'from' (or zeros if NULL) */
+static byte_t *new_page(byte_t *from)
+{
+    page_t *p = (page_t *)malloc(sizeof(page_t));
+    if (from)
+        memcpy(p->data, from, PAGE_SIZE);
+    else
+        memset(p->data, 0, PAGE_SIZE);
+    p->ref = 1;
+    return p->data;
+}
+
+/* TRUE if 'p' is a page_t, rather than zero_page or a page of m->map */
+static bool_t own_page(mem_t *m, byte_t *p)
+{
+    if (!p || p == zero_page)
+        return FALSE;
+    return !m->map || p < m->map->base || p >= m->map->base + m->map->len;
+}
+
+static void hold_page(mem_t *m, byte_t *p)
+{
+    if (own_page(m, p))
+        ((page_t *)p)->ref++;
+}
+
+static void release_page(mem_t *m, byte_t *p)
+{
+    if (own_page(m, p) && --((page_t *)p)->ref == 0)
+        free((void *) p);
+}
+
+static void hold_map(file_map_t *map)
+{
+    if (map)
+        map->ref++;
+}
+
+static void release_map(file_map_t *map)
+{
+    if (map && --map->ref == 0) {
+        munmap(map->base, map->len);
+        free((void *) map);
+    }
+}
+
+/* untouched pages read as zero_page */
+static byte_t *map_zero_page(mem_t *m, long_t addr)
+{
+    byte_t **p = &get_tab(m, addr)->rd[TAB_IDX(addr)];
+    if (!*p)
+        *p = zero_page;
+    return *p;
+}
+
+/* allocate the page of 'addr', or copy it if shared, and mark it dirty */
+static byte_t *map_dirty_page(mem_t *m, long_t addr)
+{
+    page_tab_t *t = get_tab(m, addr);
+    unsigned pg = (unsigned)addr >> PAGE_BITS;
+    int i = TAB_IDX(addr);
+    byte_t *p = t->rd[i];
+
+    if (!p || p == zero_page)
+        t->rd[i] = new_page(NULL);
+    else if (!own_page(m, p) || ((page_t *)p)->ref > 1) {
+        t->rd[i] = new_page(p);
+        release_page(m, p);
+    }
+    t->wr[i] = t->rd[i];
+    m->dirty[pg/32] |= 1u << pg%32;
+    return t->wr[i];
+}
+
+/* page to load 'addr' from */
+static inline byte_t *page_rd(mem_t *m, long_t addr)
+{
+    page_tab_t *t = m->dir[DIR_IDX(addr)];
+    if (t && t->rd[TAB_IDX(addr)])
+        return t->rd[TAB_IDX(addr)];
+    return map_zero_page(m, addr);
+}
+
+/* page to store to 'addr' */
+static inline byte_t *page_wr(mem_t *m, long_t addr)
+{
+    page_tab_t *t = m->dir[DIR_IDX(addr)];
+    if (t && t->wr[TAB_IDX(addr)])
+        return t->wr[TAB_IDX(addr)];
+    return map_dirty_page(m, addr);
+}
+
+/* note a store to [addr, addr+n) if it holds decoded code; the store
+   is inside one page, and its end is unsigned like the address */
+static inline void check_code(mem_t *m, long_t addr, int n)
+{
+    page_tab_t *t = m->dir[DIR_IDX(addr)];
+    unsigned last = (unsigned)addr + (n-1);
+    if (t->code[CODE_IDX(addr)] | t->code[CODE_IDX(last)])
+        m->smc = TRUE;
+}
+
 bool_t get_byte_val(mem_t *m, long_t addr, byte_t *dest)
 {
-    if (addr < 0 || addr >= m->len)
+    if (!IN_MEM(m, addr, 1))
         return FALSE;
-    *dest = m->data[addr];
+    *dest = page_rd(m, addr)[PAGE_OFF(addr)];
     return TRUE;
 }
 
+bool_t set_byte_val(mem_t *m, long_t addr, byte_t val)
+{
+    if (!IN_MEM(m, addr, 1))
+	    return FALSE;
+    page_wr(m, addr)[PAGE_OFF(addr)] = val;
+    check_code(m, addr, 1);
+    return TRUE;
+}
+
+/* a long that crosses a page boundary, one byte at a time */
+static long_t get_split_long(mem_t *m, long_t addr)
+{
+    int i;
+    long_t val = 0;
+    byte_t b = 0;
+
+    for (i = 0; i < 4; i++) {
+        get_byte_val(m, addr+i, &b);
+        val = val | b<<(8*i);
+    }
+    return val;
+}
+
+static void set_split_long(mem_t *m, long_t addr, long_t val)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+        set_byte_val(m, addr+i, val & 0xFF);
+        val >>= 8;
+    }
+}
+
 bool_t get_long_val(mem_t *m, long_t addr, long_t *dest)
 {
     int i;
     long_t val;
-    if (addr < 0 || addr + 4 > m->len)
+    byte_t *p;
+
+    if (!IN_MEM(m, addr, 4))
 	    return FALSE;
+    if (PAGE_OFF(addr) > PAGE_SIZE-4) {
+        *dest = get_split_long(m, addr);
+        return TRUE;
+    }
+    p = page_rd(m, addr) + PAGE_OFF(addr);
     val = 0;
     for (i = 0; i < 4; i++)
-	    val = val | m->data[addr+i]<<(8*i);
+	    val = val | p[i]<<(8*i);
     *dest = val;
     return TRUE;
 }
 
-bool_t set_byte_val(mem_t *m, long_t addr, byte_t val)
-{
-    if (addr < 0 || addr >= m->len)
-	    return FALSE;
-    m->data[addr] = val;
-    return TRUE;
-}
-
 bool_t set_long_val(mem_t *m, long_t addr, long_t val)
 {
     int i;
-    if (addr < 0 || addr + 4 > m->len)
+    byte_t *p;
+
+    if (!IN_MEM(m, addr, 4))
 	    return FALSE;
+    if (PAGE_OFF(addr) > PAGE_SIZE-4) {
+        set_split_long(m, addr, val);
+        return TRUE;
+    }
+    p = page_wr(m, addr) + PAGE_OFF(addr);
     for (i = 0; i < 4; i++) {
-    	m->data[addr+i] = val & 0xFF;
+    	p[i] = val & 0xFF;
     	val >>= 8;
     }
+    check_code(m, addr, 4);
     return TRUE;
 }
 
-mem_t *init_mem(int len)
+/* number of pages (and so dirty bits) of m */
+static long npages(mem_t *m)
 {
-    mem_t *m = (mem_t *)malloc(sizeof(mem_t));
+    return (m->len + PAGE_SIZE-1) / PAGE_SIZE;
+}
+
+/* memory of 'len' bytes, rounded up to a multiple of BLK_SIZE (see -m) */
+mem_t *init_mem(long long len)
+{
+    mem_t *m = (mem_t *)calloc(1, sizeof(mem_t));
     len = ((len+BLK_SIZE-1)/BLK_SIZE)*BLK_SIZE;
     m->len = len;
-    m->data = (byte_t *)calloc(len, 1);
+    m->dirty = (unsigned *)calloc((npages(m)+31)/32, sizeof(unsigned));
+    m->map = NULL;
+    m->smc = FALSE;
 
     return m;
 }
 
 void free_mem(mem_t *m)
 {
-    free((void *) m->data);
+    int d, i;
+
+    for (d = 0; d < DIR_SIZE; d++) {
+        if (!m->dir[d])
+            continue;
+        for (i = 0; i < TAB_SIZE; i++)
+            release_page(m, m->dir[d]->rd[i]);
+        free((void *) m->dir[d]);
+    }
+    release_map(m->map);
+    free((void *) m->dirty);
     free((void *) m);
 }
 
+/* forget which pages were stored to: the next store to each is noted again */
+void clear_dirty(mem_t *m)
+{
+    long w;
+    unsigned pg;
+
+    for (w = 0; w < (npages(m)+31)/32; w++) {
+        for (pg = w*32; m->dirty[w]; pg++) {
+            if (m->dirty[w] & 1u << pg%32) {
+                m->dirty[w] &= ~(1u << pg%32);
+                m->dir[pg/TAB_SIZE]->wr[pg%TAB_SIZE] = NULL;
+            }
+        }
+    }
+}
+
+/* copy of 'oldm' with no dirty pages */
 mem_t *dup_mem(mem_t *oldm)
 {
     mem_t *newm = init_mem(oldm->len);
-    memcpy(newm->data, oldm->data, oldm->len);
+    page_tab_t *t;
+    int d, i;
+
+    for (d = 0; d < DIR_SIZE; d++) {
+        if (!(t = oldm->dir[d]))
+            continue;
+        for (i = 0; i < TAB_SIZE; i++)
+            if (t->rd[i] && t->rd[i] != zero_page)
+                memcpy(page_wr(newm, (unsigned)(d*TAB_SIZE+i) << PAGE_BITS),
+                       t->rd[i], PAGE_SIZE);
+    }
+    clear_dirty(newm);
     return newm;
 }
 
-bool_t diff_mem(mem_t *oldm, mem_t *newm, FILE *outfile)
+/* print the longs that differ in page 'pg' of 'oldm' and 'newm' */
+static bool_t diff_page(mem_t *oldm, mem_t *newm, unsigned pg, FILE *outfile)
 {
-    long_t pos;
-    int len = oldm->len;
+    long_t pos = pg << PAGE_BITS;
+    unsigned off;
     bool_t diff = FALSE;
-    
-    if (newm->len < len)
-	    len = newm->len;
-    
-    for (pos = 0; (!diff || outfile) && pos < len; pos += 4) {
+
+    if (!memcmp(page_rd(oldm, pos), page_rd(newm, pos), PAGE_SIZE))
+        return FALSE;
+    for (off = 0; (!diff || outfile) && off < PAGE_SIZE; off += 4) {
         long_t ov = 0;  long_t nv = 0;
+        pos = (pg << PAGE_BITS) + off;
+        if (!IN_MEM(newm, pos, 4) || !IN_MEM(oldm, pos, 4))
+            break;
         get_long_val(oldm, pos, &ov);
         get_long_val(newm, pos, &nv);
         if (nv != ov) {
@@ -125,6 +341,126 @@ bool_t diff_mem(mem_t *oldm, mem_t *newm, FILE *outfile)
     return diff;
 }
 
+/*
+ * diff_mem: print the longs that differ between 'oldm' and 'newm'
+ *     only pages dirty in either are compared, so the two must have been
+ *     equal (as after dup_mem()) when their dirty bitmaps were last cleared
+ *
+ * return
+ *     TRUE if any long differs
+ */
+bool_t diff_mem(mem_t *oldm, mem_t *newm, FILE *outfile)
+{
+    long long len = oldm->len;
+    unsigned pg, n, bits;
+    bool_t diff = FALSE;
+    
+    if (newm->len < len)
+	    len = newm->len;
+    n = (len + PAGE_SIZE-1) / PAGE_SIZE;
+    
+    for (pg = 0; (!diff || outfile) && pg < n; pg++) {
+        bits = oldm->dirty[pg/32] | newm->dirty[pg/32];
+        if (!bits) {
+            pg |= 31;   /* skip 32 clean pages */
+            continue;
+        }
+        if (bits & 1u << pg%32)
+            diff |= diff_page(oldm, newm, pg, outfile);
+    }
+    return diff;
+}
+
+/*
+ * share_mem: copy of 'm' that shares all its pages
+ *     m loses its write mappings, so a store to either copies the page
+ */
+mem_t *share_mem(mem_t *m)
+{
+    mem_t *newm = init_mem(m->len);
+    int d, i;
+
+    clear_dirty(m);
+    newm->map = m->map;
+    hold_map(m->map);
+    for (d = 0; d < DIR_SIZE; d++) {
+        if (!m->dir[d])
+            continue;
+        newm->dir[d] = (page_tab_t *)calloc(1, sizeof(page_tab_t));
+        for (i = 0; i < TAB_SIZE; i++) {
+            newm->dir[d]->rd[i] = m->dir[d]->rd[i];
+            hold_page(m, m->dir[d]->rd[i]);
+        }
+    }
+    return newm;
+}
+
+/* page 'i' of table 't' (which may be NULL), untouched pages as zero_page */
+static byte_t *tab_page(page_tab_t *t, int i)
+{
+    return t && t->rd[i] ? t->rd[i] : zero_page;
+}
+
+/*
+ * restore_mem: make 'm' share the contents of 'from' again
+ *     only pages whose address differs are replaced
+ *
+ * return
+ *     TRUE if a replaced page of m held decoded code
+ */
+bool_t restore_mem(mem_t *m, mem_t *from)
+{
+    page_tab_t *t;
+    byte_t *p;
+    bool_t code = FALSE;
+    int d, i;
+
+    for (d = 0; d < DIR_SIZE; d++) {
+        if (!m->dir[d] && !from->dir[d])
+            continue;
+        t = get_tab(m, (long_t)((unsigned)d << (TAB_BITS+PAGE_BITS)));
+        for (i = 0; i < TAB_SIZE; i++) {
+            p = tab_page(from->dir[d], i);
+            if (tab_page(t, i) == p)
+                continue;
+            code |= t->code_page[i];
+            hold_page(from, p);
+            release_page(m, t->rd[i]);
+            t->rd[i] = p;
+            t->wr[i] = NULL;
+        }
+    }
+    /* every page of m is now one of from's */
+    hold_map(from->map);
+    release_map(m->map);
+    m->map = from->map;
+    clear_dirty(m);
+    return code;
+}
+
+/*
+ * diff_shared_mem: diff_mem() for images that share pages (share_mem()),
+ *     comparing every page that is no longer shared
+ */
+bool_t diff_shared_mem(mem_t *oldm, mem_t *newm, FILE *outfile)
+{
+    int d, i;
+    unsigned pg;
+    bool_t diff = FALSE;
+
+    for (d = 0; (!diff || outfile) && d < DIR_SIZE; d++) {
+        if (!oldm->dir[d] && !newm->dir[d])
+            continue;
+        for (i = 0; (!diff || outfile) && i < TAB_SIZE; i++) {
+            pg = d*TAB_SIZE + i;
+            if (tab_page(oldm->dir[d], i) != tab_page(newm->dir[d], i) &&
+                pg < (oldm->len + PAGE_SIZE-1) / PAGE_SIZE)
+                diff |= diff_page(oldm, newm, pg, outfile);
+        }
+    }
+    return diff;
+}
+
 
 reg_t reg_table[REG_CNT] = {
     {"%eax", REG_EAX},
@@ -192,13 +528,17 @@ bool_t diff_reg(mem_t *oldr, mem_t *newr, FILE *outfile)
 }
 
 /* create an y86 image with registers and memory */
-y86sim_t *new_y86sim(int slen)
+y86sim_t *new_y86sim(long long slen)
 {
     y86sim_t *sim = (y86sim_t*)malloc(sizeof(y86sim_t));
     sim->pc = 0;
     sim->r = init_reg();
     sim->m = init_mem(slen);
     sim->cc = DEFAULT_CC;
+    sim->cc_lazy = FALSE;
+    sim->ic = NULL;
+    sim->out = stdout;
+    sim->prof = NULL;
     return sim;
 }
 
@@ -206,22 +546,131 @@ void free_y86sim(y86sim_t *sim)
 {
     free_reg(sim->r);
     free_mem(sim->m);
+#ifdef HAS_JIT
+    if (sim->ic)
+        jit_free(sim->ic);
+#endif
+    free((void *) sim->ic);
+    if (sim->prof)
+        prof_free(sim->prof);
     free((void *) sim);
 }
 
+/*
+ * take_snapshot: checkpoint the registers, memory, CC and PC of 'sim'
+ *     memory is shared copy-on-write, so this costs a page table copy
+ */
+snapshot_t *take_snapshot(y86sim_t *sim)
+{
+    snapshot_t *snap = (snapshot_t *)malloc(sizeof(snapshot_t));
+    snap->pc = sim->pc;
+    snap->cc = get_cc(sim);
+    snap->r = share_mem(sim->r);
+    snap->m = share_mem(sim->m);
+    return snap;
+}
+
+/* restore_snapshot: return 'sim' to the state 'snap' was taken in */
+void restore_snapshot(y86sim_t *sim, snapshot_t *snap)
+{
+    restore_mem(sim->r, snap->r);
+    if (restore_mem(sim->m, snap->m) && sim->ic)
+        icache_flush(sim);
+    sim->pc = snap->pc;
+    set_cc(sim, snap->cc);
+}
+
+/* diff_snapshot: print register and memory changes since 'snap' */
+bool_t diff_snapshot(snapshot_t *snap, y86sim_t *sim, FILE *outfile)
+{
+    bool_t diff;
+
+    if (outfile)
+        fprintf(outfile, "Changes to registers:\n");
+    diff = diff_reg(snap->r, sim->r, outfile);
+    if (outfile)
+        fprintf(outfile, "\nChanges to memory:\n");
+    return diff_shared_mem(snap->m, sim->m, outfile) || diff;
+}
+
+void free_snapshot(snapshot_t *snap)
+{
+    free_mem(snap->r);
+    free_mem(snap->m);
+    free((void *) snap);
+}
+
+/*
+ * map_binfile: use the pages of regular file 'f' as the initial memory of
+ *     'sim' (MAP_PRIVATE, read only: a store copies the page first)
+ *
+ * return
+ *     0: mapped, 1: can't be mapped (read it instead), -1: too large
+ */
+static int map_binfile(y86sim_t *sim, FILE *f)
+{
+    mem_t *m = sim->m;
+    struct stat st;
+    file_map_t *map;
+    page_tab_t *t;
+    void *base;
+    long long pos;
+
+    if (m->map || fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode) ||
+        st.st_size == 0)
+        return 1;
+    if (st.st_size >= m->len) {
+        /* as read: a file that fills all of memory has no EOF in it */
+        sim_err(sim, "too large memory footprint (0x%x)", (int)m->len);
+        return -1;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (base == MAP_FAILED)
+        return 1;
+
+    map = (file_map_t *)malloc(sizeof(file_map_t));
+    map->base = (byte_t *)base;
+    map->len = st.st_size;
+    map->ref = 1;
+    m->map = map;
+    for (pos = 0; pos < st.st_size; pos += PAGE_SIZE) {
+        t = get_tab(m, (long_t)pos);
+        release_page(m, t->rd[TAB_IDX(pos)]);
+        t->rd[TAB_IDX(pos)] = map->base + pos;
+        t->wr[TAB_IDX(pos)] = NULL;
+    }
+    return 0;
+}
+
 /* load binary code and data from file to memory image */
-int load_binfile(mem_t *m, FILE *f)
+int load_binfile(y86sim_t *sim, FILE *f)
 {
-    int flen;
+    mem_t *m = sim->m;
+    byte_t buf[PAGE_SIZE];
+    long long flen = 0;
+    int n, want, i;
+
+    n = map_binfile(sim, f);
+    if (n <= 0)
+        return n;
 
     clearerr(f);
-    flen = fread(m->data, sizeof(byte_t), m->len, f);
+    do {
+        want = m->len - flen < PAGE_SIZE ? m->len - flen : PAGE_SIZE;
+        n = fread(buf, sizeof(byte_t), want, f);
+        /* leave all-zero pages unallocated */
+        for (i = 0; i < n && !buf[i]; i++)
+            ;
+        if (i < n)
+            memcpy(page_wr(m, flen), buf, n);
+        flen += n;
+    } while (n == want && flen < m->len);
     if (ferror(f)) {
-        err_print("fread() failed (0x%x)", flen);
+        sim_err(sim, "fread() failed (0x%x)", (int)flen);
         return -1;
     }
     if (!feof(f)) {
-        err_print("too large memory footprint (0x%x)", flen);
+        sim_err(sim, "too large memory footprint (0x%x)", (int)flen);
         return -1;
     }
     return 0;
@@ -299,6 +748,42 @@ cc_t compute_cc(alu_t op, long_t argA, long_t argB, long_t val)
     return PACK_CC(zero,sign,ovf);
 }
 
+/*
+ * set_cc_lazy: record an ALU operation, its condition codes are computed
+ *     only when get_cc() needs them
+ */
+static inline void set_cc_lazy(y86sim_t *sim, alu_t op,
+                               long_t argA, long_t argB, long_t val)
+{
+    sim->cc_lazy = TRUE;
+    sim->cc_op = op;
+    sim->cc_argA = argA;
+    sim->cc_argB = argB;
+    sim->cc_val = val;
+}
+
+/*
+ * get_cc: return the current condition codes
+ */
+cc_t get_cc(y86sim_t *sim)
+{
+    if (sim->cc_lazy) {
+        sim->cc = compute_cc(sim->cc_op, sim->cc_argA, sim->cc_argB,
+                             sim->cc_val);
+        sim->cc_lazy = FALSE;
+    }
+    return sim->cc;
+}
+
+/*
+ * set_cc: overwrite the condition codes, dropping any pending ALU operation
+ */
+void set_cc(y86sim_t *sim, cc_t cc)
+{
+    sim->cc = cc;
+    sim->cc_lazy = FALSE;
+}
+
 /*
  * cond_doit: whether do (mov or jmp) it?  
  * args
@@ -363,7 +848,7 @@ stat_t nexti(y86sim_t *sim)
     long_t next_pc = sim->pc;
     /* get code and function (1 byte) */
     if (!get_byte_val(sim->m, next_pc, &codefun)) {
-        err_print("PC = 0x%x, Invalid instruction address", sim->pc);
+        sim_err(sim, "PC = 0x%x, Invalid instruction address", sim->pc);
         return STAT_ADR;
     }
     icode = GET_ICODE(codefun);
@@ -392,7 +877,7 @@ stat_t nexti(y86sim_t *sim)
     {
         byte_t code;
         if(!get_byte_val(sim->m,next_pc,&code)){
-            err_print("PC = 0x%x, Invalid instruction address", sim->pc);
+            sim_err(sim, "PC = 0x%x, Invalid instruction address", sim->pc);
             return STAT_ADR;
         }
         ra = GET_REGA(code);
@@ -416,7 +901,7 @@ stat_t nexti(y86sim_t *sim)
     if(getImmed == TRUE)
     {
         if(!get_long_val(sim->m, next_pc, &valC)){
-            err_print("PC = 0x%x, Invalid instruction address", sim->pc);
+            sim_err(sim, "PC = 0x%x, Invalid instruction address", sim->pc);
             return STAT_ADR;
         }
         next_pc+=4;
@@ -432,7 +917,7 @@ stat_t nexti(y86sim_t *sim)
             sim->pc = next_pc;
             break;
         case I_RRMOVL:  /* 2:x regA:regB */
-            OK = cond_doit(sim->cc,ifun);
+            OK = cond_doit(get_cc(sim), ifun);
             if(OK == TRUE)
                 set_reg_val(sim->r, rb, valA);
             break;
@@ -443,7 +928,7 @@ stat_t nexti(y86sim_t *sim)
             valE = valB + valC;
             OK = set_long_val(sim->m, valE, valA);
             if(OK == FALSE){
-                err_print("PC = 0x%x, Invalid data address 0x%x", sim->pc, valE);
+                sim_err(sim, "PC = 0x%x, Invalid data address 0x%x", sim->pc, valE);
                 return STAT_ADR;
             }
             break;
@@ -452,7 +937,7 @@ stat_t nexti(y86sim_t *sim)
             valE = valB + valC;
             OK = get_long_val(sim->m, valE, &valM);
             if(OK == FALSE){
-                err_print("PC = 0x%x, Invalid data address 0x%x", sim->pc, valE);
+                sim_err(sim, "PC = 0x%x, Invalid data address 0x%x", sim->pc, valE);
                 return STAT_ADR;
             }
             set_reg_val(sim->r, ra, valM);
@@ -460,11 +945,11 @@ stat_t nexti(y86sim_t *sim)
 
         case I_ALU: /* 6:x regA:regB */
             valE = compute_alu(ifun, valA, valB);
-            sim->cc = compute_cc(ifun,valA,valB,valE);
+            set_cc_lazy(sim, ifun, valA, valB, valE);
             set_reg_val(sim->r,rb,valE);
             break;
         case I_JMP: /* 7:x imm */
-            OK = cond_doit(sim->cc, ifun);
+            OK = cond_doit(get_cc(sim), ifun);
             if(OK == TRUE){
                 sim->pc = valC;
                 return STAT_AOK;
@@ -479,7 +964,7 @@ stat_t nexti(y86sim_t *sim)
             set_reg_val(sim->r,REG_ESP, valE);
             OK = set_long_val(sim->m, valE ,next_pc);
             if(OK == FALSE){
-                err_print("PC = 0x%x, Invalid stack address 0x%x", sim->pc, valE);
+                sim_err(sim, "PC = 0x%x, Invalid stack address 0x%x", sim->pc, valE);
                 return STAT_ADR;
             }
             sim->pc = valC;
@@ -491,7 +976,7 @@ stat_t nexti(y86sim_t *sim)
             //sim->cc = compute_cc(A_ADD,valB,4,valE);
 
             if(!get_long_val(sim->m, valA, &valM)){
-                err_print("PC = 0x%x, Invalid data address 0x%x", sim->pc, valA);
+                sim_err(sim, "PC = 0x%x, Invalid data address 0x%x", sim->pc, valA);
                 return STAT_ADR;
             }
             set_reg_val(sim->r, REG_ESP, valE);
@@ -507,7 +992,7 @@ stat_t nexti(y86sim_t *sim)
             set_reg_val(sim->r, REG_ESP, valE);
             
             if(OK == FALSE){
-                err_print("PC = 0x%x, Invalid stack address 0x%x", sim->pc, valE);
+                sim_err(sim, "PC = 0x%x, Invalid stack address 0x%x", sim->pc, valE);
                 return STAT_ADR;
             }
             break;
@@ -518,7 +1003,7 @@ stat_t nexti(y86sim_t *sim)
             //sim->cc = compute_cc(A_ADD,valB,4,valE);
             
             if(!get_long_val(sim->m, valA, &valM)){
-                err_print("error popl%x",sim->pc);
+                sim_err(sim, "error popl%x",sim->pc);
                 return STAT_ADR;
             }
             
@@ -526,74 +1011,453 @@ stat_t nexti(y86sim_t *sim)
             set_reg_val(sim->r, ra, valM);
             break;
         default:
-            err_print("PC = 0x%x, Invalid instruction %.2x", sim->pc, codefun);
+            sim_err(sim, "PC = 0x%x, Invalid instruction %.2x", sim->pc, codefun);
             return STAT_INS;
     }
     sim->pc = next_pc; 
     return STAT_AOK;
 }
 
+/*
+ * icache_flush: drop all decoded blocks and forget which memory holds code
+ */
+void icache_flush(y86sim_t *sim)
+{
+    icache_t *ic = sim->ic;
+    page_tab_t *t;
+    int d, i;
+
+    memset(ic->tab, 0, sizeof(ic->tab));
+    ic->nblocks = 0;
+    ic->nuops = 0;
+    ic->flushes++;
+    ic->jit_used = ic->jit_start;
+    for (d = 0; d < DIR_SIZE; d++) {
+        if (!(t = sim->m->dir[d]))
+            continue;
+        for (i = 0; i < TAB_SIZE; i++) {
+            if (t->code_page[i]) {
+                memset(&t->code[i*(PAGE_SIZE/BLK_SIZE)], 0, PAGE_SIZE/BLK_SIZE);
+                t->code_page[i] = 0;
+            }
+        }
+    }
+    sim->m->smc = FALSE;
+}
+
+void icache_init(y86sim_t *sim)
+{
+    if (!sim->ic) {
+        sim->ic = (icache_t *)calloc(1, sizeof(icache_t));
+        icache_flush(sim);
+    }
+}
+
+/* mark memory [pc, next_pc) as decoded, so stores there flush the cache;
+ * an instruction is shorter than BLK_SIZE, so it spans at most two blocks */
+static void mark_code(mem_t *m, long_t pc, long_t next_pc)
+{
+    page_tab_t *t = get_tab(m, pc);
+    t->code_page[TAB_IDX(pc)] = 1;
+    t->code[CODE_IDX(pc)] = 1;
+    t = get_tab(m, next_pc-1);
+    t->code_page[TAB_IDX(next_pc-1)] = 1;
+    t->code[CODE_IDX(next_pc-1)] = 1;
+}
+
+/*
+ * decode_uop: fetch and decode the instruction at 'pc' into 'u'
+ *     halt, bad addresses, bad icode/ifun and writes to a non-register
+ *     all become U_SLOW, which nexti() executes and reports exactly
+ *
+ * return
+ *     TRUE: the instruction ends a block
+ *     FALSE: execution falls through to u->next_pc
+ */
+static bool_t decode_uop(mem_t *m, long_t pc, uop_t *u)
+{
+    byte_t codefun = 0, regs = HPACK(REG_NONE, REG_NONE);
+    long_t valC = 0;
+    long_t next_pc = pc;
+    bool_t ok = TRUE;
+
+    u->icode = U_SLOW;
+    u->pc = pc;
+    u->next_pc = pc;
+    if (!get_byte_val(m, next_pc++, &codefun))
+        return TRUE;
+
+    switch (GET_ICODE(codefun)) {
+        case I_RRMOVL: case I_IRMOVL: case I_RMMOVL: case I_MRMOVL:
+        case I_ALU: case I_PUSHL: case I_POPL:
+            if (!get_byte_val(m, next_pc++, &regs))
+                return TRUE;
+            break;
+        case I_NOP: case I_JMP: case I_CALL: case I_RET:
+            break;
+        default:
+            return TRUE;
+    }
+    switch (GET_ICODE(codefun)) {
+        case I_IRMOVL: case I_RMMOVL: case I_MRMOVL: case I_JMP: case I_CALL:
+            if (!get_long_val(m, next_pc, &valC))
+                return TRUE;
+            next_pc += 4;
+            break;
+        default:
+            break;
+    }
+
+    u->ifun = GET_FUN(codefun);
+    u->ra = GET_REGA(regs);
+    u->rb = GET_REGB(regs);
+    u->valC = valC;
+    u->next_pc = next_pc;
+    switch (GET_ICODE(codefun)) {
+        case I_RRMOVL:
+            ok = u->ifun <= C_G && NORM_REG(u->rb);
+            break;
+        case I_IRMOVL:
+            ok = NORM_REG(u->rb);
+            break;
+        case I_MRMOVL: case I_POPL:
+            ok = NORM_REG(u->ra);
+            break;
+        case I_ALU:
+            ok = u->ifun <= A_XOR && NORM_REG(u->rb);
+            break;
+        case I_JMP:
+            ok = u->ifun <= C_G;
+            break;
+        default:
+            break;
+    }
+    if (!ok)
+        return TRUE;
+
+    u->icode = GET_ICODE(codefun);
+    mark_code(m, pc, next_pc);
+    switch (u->icode) {
+        case I_JMP: case I_CALL: case I_RET:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/*
+ * find_block: look up the block starting at 'pc', decoding it on a miss
+ *     a U_END uop follows the last instruction; 'labels' (if not NULL)
+ *     maps icodes to the threaded-code handler stored in each uop
+ */
+block_t *find_block(y86sim_t *sim, long_t pc, void **labels)
+{
+    icache_t *ic = sim->ic;
+    block_t *b = ic->tab[pc & (ICACHE_SIZE-1)];
+    uop_t *u;
+    bool_t last;
+    int i;
+
+    if (b && b->pc == pc)
+        return b;
+
+    if (ic->nblocks == BLOCK_POOL || ic->nuops + BLOCK_MAX + 1 > UOP_POOL)
+        icache_flush(sim);
+    b = &ic->blocks[ic->nblocks++];
+    b->pc = pc;
+    b->uops = &ic->uops[ic->nuops];
+    b->len = 0;
+    b->hits = 0;
+    b->jit = NULL;
+    do {
+        u = &b->uops[b->len++];
+        last = decode_uop(sim->m, pc, u);
+        pc = u->next_pc;
+    } while (!last && b->len < BLOCK_MAX);
+    u = &b->uops[b->len];
+    u->icode = U_END;
+    u->pc = pc;
+    if (labels)
+        for (i = 0; i <= b->len; i++)
+            b->uops[i].handler = labels[b->uops[i].icode];
+    ic->nuops += b->len + 1;
+    ic->tab[b->pc & (ICACHE_SIZE-1)] = b;
+    return b;
+}
+
+/* registers are kept in a local array while running decoded code;
+ * slots 8..15 stay zero so that reading any register id is safe */
+static void load_regs(y86sim_t *sim, long_t *reg)
+{
+    int i;
+    for (i = 0; i < 16; i++)
+        reg[i] = get_reg_val(sim->r, i);
+}
+
+static void store_regs(y86sim_t *sim, long_t *reg)
+{
+    int i;
+    for (i = 0; i < REG_CNT; i++)
+        set_reg_val(sim->r, i, reg[i]);
+}
+
+/* run_nexti: the reference engine, one nexti() call per instruction */
+stat_t run_nexti(y86sim_t *sim, int max_steps, int *steps)
+{
+    int step;
+    stat_t e = STAT_AOK;
+
+    for (step = 0; step < max_steps && e == STAT_AOK; step++)
+        e = nexti(sim);
+    *steps = step;
+    return e;
+}
+
+/*
+ * prof_nexti: nexti() for the profiling engine, recording the
+ *     instruction, its memory access and its jump direction in sim->prof
+ */
+stat_t prof_nexti(y86sim_t *sim)
+{
+    uop_t u;
+    byte_t code = 0;
+    long_t addr = 0, pc = sim->pc;
+    bool_t write = FALSE, mem = TRUE, taken = FALSE;
+    stat_t e;
+
+    get_byte_val(sim->m, pc, &code);
+    decode_uop(sim->m, pc, &u);
+    switch (u.icode) {
+        case I_RMMOVL: case I_MRMOVL:
+            write = u.icode == I_RMMOVL;
+            addr = get_reg_val(sim->r, u.rb) + u.valC;
+            break;
+        case I_PUSHL: case I_CALL: write = TRUE;
+            addr = get_reg_val(sim->r, REG_ESP) - 4;
+            break;
+        case I_POPL: case I_RET:
+            addr = get_reg_val(sim->r, REG_ESP);
+            break;
+        case I_JMP:
+            taken = cond_doit(get_cc(sim), u.ifun);
+            mem = FALSE;
+            break;
+        default:
+            mem = FALSE;
+            break;
+    }
+
+    e = nexti(sim);
+    prof_exec(sim->prof, pc, code);
+    if (e != STAT_AOK)
+        return e;
+    if (mem)
+        prof_mem(sim->prof, addr, write);
+    if (u.icode == I_JMP && u.ifun != C_YES)
+        prof_jump(sim->prof, pc, taken);
+    return e;
+}
+
+/* decoded-block engines, see y86run.h */
+#define RUN_NAME run_switch
+#define RUN_THREADED 0
+#define RUN_PROFILE 0
+#include "y86run.h"
+#undef RUN_NAME
+#undef RUN_THREADED
+
+#ifdef __GNUC__
+#define RUN_NAME run_threaded
+#define RUN_THREADED 1
+#include "y86run.h"
+#undef RUN_NAME
+#undef RUN_PROFILE
+
+/* -p: the threaded engine with every instruction counted */
+#define RUN_NAME run_profile
+#define RUN_PROFILE 1
+#include "y86run.h"
+#undef RUN_NAME
+#undef RUN_THREADED
+#undef RUN_PROFILE
+#else
+/* no labels as values: the threaded engine is the switch engine */
+#define run_threaded run_switch
+#undef RUN_PROFILE
+
+#define RUN_NAME run_profile
+#define RUN_THREADED 0
+#define RUN_PROFILE 1
+#include "y86run.h"
+#undef RUN_NAME
+#undef RUN_THREADED
+#undef RUN_PROFILE
+#endif
+
+struct {
+    char *name;
+    engine_t run;
+} engine_table[] = {
+#ifdef HAS_JIT
+    {"jit", run_jit},               /* default */
+#endif
+    {"threaded", run_threaded},
+    {"switch", run_switch},
+    {"nexti", run_nexti},
+    {NULL, NULL}
+};
+
+engine_t find_engine(char *name)
+{
+    int i;
+    for (i = 0; engine_table[i].name; i++)
+        if (!strcmp(engine_table[i].name, name))
+            return engine_table[i].run;
+    return NULL;
+}
+
 void usage(char *pname)
 {
-    printf("Usage: %s file.bin [max_steps]\n", pname);
+    int i;
+
+    printf("Usage: %s [-e engine] [-m mem_size] [-p] file.bin [max_steps]\n",
+           pname);
+    printf("   Or: %s [-e engine] [-m mem_size] [-j threads] -b manifest\n",
+           pname);
+    printf("   -e execution engine: %s (default)", engine_table[0].name);
+    for (i = 1; engine_table[i].name; i++)
+        printf(", %s", engine_table[i].name);
+    printf("\n");
+    printf("   -m bytes of memory, with an optional k/m/g suffix,"
+           " at most 4g (default 0x%x)\n", MEM_SIZE);
+    printf("      rounded up to a multiple of %d\n", BLK_SIZE);
+    printf("   -b run every test of the manifest, one per line:"
+           " file.bin [max_steps] [expected]\n");
+    printf("   -j worker threads for -b (default: one per CPU)\n");
+    printf("   -p profile the run and print its hot spots"
+           " (annotated from file.yo if found)\n");
     exit(0);
 }
 
-int main(int argc, char *argv[])
+/* parse a -m argument, return 0 if it is invalid */
+long long parse_size(char *s)
+{
+    char *end;
+    long long size = strtoll(s, &end, 0);
+
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+    }
+    if (*end || size <= 0 || size > MEM_MAX)
+        return 0;
+    return size;
+}
+
+/*
+ * sim_file: load 'fname' into 'sim', run it for up to 'max_steps' with
+ *     engine 'run' and print the final state and its changes to sim->out
+ *
+ * return
+ *     0, or -1 if the file could not be loaded
+ */
+int sim_file(y86sim_t *sim, char *fname, engine_t run, int max_steps)
 {
     FILE *binfile;
-    int max_steps = MAX_STEP;
-    y86sim_t *sim;
-    mem_t *saver, *savem;
+    snapshot_t *snap;
     int step = 0;
     stat_t e = STAT_AOK;
 
-    if (argc < 2 || argc > 3)
-        usage(argv[0]);
-
-    /* set max steps */
-    if (argc > 2)
-        max_steps = atoi(argv[2]);
-
-    /* load binary file to memory */
-    if (strcmp(argv[1]+(strlen(argv[1])-4), ".bin"))
-        usage(argv[0]); /* only support *.bin file */
-    
-    binfile = fopen(argv[1], "rb");
+    binfile = fopen(fname, "rb");
     if (!binfile) {
-        err_print("Can't open binary file '%s'", argv[1]);
-        exit(1);
+        sim_err(sim, "Can't open binary file '%s'", fname);
+        return -1;
     }
-
-    sim = new_y86sim(MEM_SIZE);
-    if (load_binfile(sim->m, binfile) < 0) {
-        err_print("Failed to load binary file '%s'", argv[1]);
-        free_y86sim(sim);
-        exit(1);
+    if (load_binfile(sim, binfile) < 0) {
+        sim_err(sim, "Failed to load binary file '%s'", fname);
+        fclose(binfile);
+        return -1;
     }
     fclose(binfile);
 
     /* save initial register and memory stat */
-    saver = dup_reg(sim->r);
-    savem = dup_mem(sim->m);
+    snap = take_snapshot(sim);
 
-    /* execute binary code step-by-step */
-    for (step = 0; step < max_steps && e == STAT_AOK; step++)
-        e = nexti(sim);
+    /* execute binary code */
+    e = run(sim, max_steps, &step);
     /* print final stat of y86sim */
-    printf("Stopped in %d steps at PC = 0x%x.  Status '%s', CC %s\n",
-            step, sim->pc, stat_name(e), cc_name(sim->cc));
+    fprintf(sim->out,
+            "Stopped in %d steps at PC = 0x%x.  Status '%s', CC %s\n",
+            step, sim->pc, stat_name(e), cc_name(get_cc(sim)));
+
+    diff_snapshot(snap, sim, sim->out);
+    if (sim->prof)
+        prof_report(sim->prof, fname, sim->out);
+
+    free_snapshot(snap);
+    return 0;
+}
 
-    printf("Changes to registers:\n");
-    diff_reg(saver, sim->r, stdout);
+int main(int argc, char *argv[])
+{
+    int max_steps = MAX_STEP;
+    int nextarg = 1;
+    engine_t run = engine_table[0].run;
+    long long mem_size = MEM_SIZE;
+    char *manifest = NULL;
+    int threads = 0;
+    bool_t profile = FALSE;
+    y86sim_t *sim;
 
-    printf("\nChanges to memory:\n");
-    diff_mem(savem, sim->m, stdout);
+    while (argc - nextarg >= 2 && argv[nextarg][0] == '-') {
+        if (!strcmp(argv[nextarg], "-p")) {
+            profile = TRUE;
+            nextarg++;
+            continue;
+        }
+        if (!strcmp(argv[nextarg], "-e"))
+            run = find_engine(argv[nextarg+1]);
+        else if (!strcmp(argv[nextarg], "-m"))
+            mem_size = parse_size(argv[nextarg+1]);
+        else if (!strcmp(argv[nextarg], "-b"))
+            manifest = argv[nextarg+1];
+        else if (!strcmp(argv[nextarg], "-j"))
+            threads = atoi(argv[nextarg+1]);
+        else
+            usage(argv[0]);
+        if (!run || !mem_size || threads < 0)
+            usage(argv[0]);
+        nextarg += 2;
+    }
+
+    if (manifest) {
+        if (argc != nextarg || profile)
+            usage(argv[0]);
+        return run_batch(manifest, threads, run, mem_size);
+    }
+
+    if (argc - nextarg < 1 || argc - nextarg > 2)
+        usage(argv[0]);
 
+    /* set max steps */
+    if (argc - nextarg > 1)
+        max_steps = atoi(argv[nextarg+1]);
+
+    /* load binary file to memory */
+    if (strcmp(argv[nextarg]+(strlen(argv[nextarg])-4), ".bin"))
+        usage(argv[0]); /* only support *.bin file */
+    
+    sim = new_y86sim(mem_size);
+    if (profile) {
+        sim->prof = prof_new();
+        run = run_profile;
+    }
+    if (sim_file(sim, argv[nextarg], run, max_steps) < 0) {
+        free_y86sim(sim);
+        exit(1);
+    }
     free_y86sim(sim);
-    free_reg(saver);
-    free_mem(savem);
 
     return 0;
 }
-
@@ -17,6 +17,8 @@ typedef int long_t;
 typedef unsigned char cc_t;
 typedef enum { FALSE, TRUE } bool_t;
 
+typedef enum {STAT_AOK, STAT_HLT, STAT_ADR, STAT_INS} stat_t;
+
 /* Y86 Condition Code */
 #define GET_ZF(cc) (((cc) >> 2)&0x1)
 #define GET_SF(cc) (((cc) >> 1)&0x1)
@@ -66,17 +68,158 @@ typedef enum { D_DATA, D_POS, D_ALIGN } dtv_t;
 #define GET_REGB(byte0) LOW(byte0)
 
 
+/* Paged memory: a two-level table maps a 32-bit address to a page,
+ * which is only allocated when the page is first stored to */
+#define PAGE_BITS 12
+#define PAGE_SIZE (1<<PAGE_BITS)
+#define TAB_BITS  10
+#define TAB_SIZE  (1<<TAB_BITS)                 /* pages per table */
+#define TAB_SPAN  (TAB_SIZE*PAGE_SIZE)          /* bytes per table */
+#define DIR_SIZE  (1<<(32-TAB_BITS-PAGE_BITS))  /* tables per memory */
+#define MEM_MAX   (1LL<<32)
+
+/* a page may be shared by several images (see take_snapshot()) */
+typedef struct page {
+    byte_t data[PAGE_SIZE];
+    int ref;
+} page_t;
+
+typedef struct page_tab {
+    byte_t *rd[TAB_SIZE];   /* page to load from, NULL if untouched */
+    byte_t *wr[TAB_SIZE];   /* same, once dirty and not shared */
+    byte_t code_page[TAB_SIZE];         /* page holds decoded code */
+    byte_t code[TAB_SPAN/BLK_SIZE];     /* per-BLK_SIZE flags of the same */
+} page_tab_t;
+
+/* a .bin file mapped read-only (MAP_PRIVATE): its pages are used as the
+ * initial pages of an image, and copied to a page_t on the first store */
+typedef struct file_map {
+    byte_t *base;
+    size_t len;
+    int ref;        /* images whose pages may point into it */
+} file_map_t;
+
 typedef struct mem {
-    int len;
-    byte_t *data;
+    long long len;
+    page_tab_t *dir[DIR_SIZE];
+    file_map_t *map;    /* file whose pages rd[] may point to, or NULL */
+    unsigned *dirty;    /* bitmap: pages stored to since clear_dirty() */
+    bool_t smc;         /* a store has hit decoded code since last flush */
 } mem_t;
 
+/* Decoded instruction cache */
+#define ICACHE_SIZE (1<<10)   /* direct-mapped block entries */
+#define BLOCK_POOL  (1<<10)
+#define UOP_POOL    (1<<14)
+#define BLOCK_MAX   32        /* max instructions per block */
+
+/* pseudo icodes: let nexti() execute (and report) this instruction,
+ * and continue at the next block (follows every block's last uop) */
+#define U_SLOW 0x10
+#define U_END  0x11
+
+typedef struct uop {
+    byte_t icode;
+    byte_t ifun;
+    byte_t ra;
+    byte_t rb;
+    long_t valC;
+    long_t pc;
+    long_t next_pc;
+    void *handler;  /* threaded engine: address of the code for icode */
+} uop_t;
+
+/* straight-line run of instructions, ended by jXX/call/ret/U_SLOW
+ * (or BLOCK_MAX), followed by a U_END uop */
+typedef struct block {
+    long_t pc;
+    int len;
+    uop_t *uops;
+    int hits;       /* JIT engine: times interpreted so far */
+    byte_t *jit;    /* JIT engine: native code, or NULL */
+} block_t;
+
+typedef struct icache {
+    block_t *tab[ICACHE_SIZE];
+    block_t blocks[BLOCK_POOL];
+    uop_t uops[UOP_POOL];
+    int nblocks;
+    int nuops;
+    int flushes;
+
+    /* JIT engine: translated blocks live in jit_buf[jit_start, jit_used) */
+    byte_t *jit_buf;
+    int jit_size;
+    int jit_start;
+    int jit_used;
+} icache_t;
+
+/* execution profile, see y86prof.c */
+#define PROF_RANGE 64   /* memory accesses are counted per range of bytes */
+typedef struct prof prof_t;
+
 typedef struct y86sim {
     long_t pc;
     mem_t *r;
     mem_t *m;
-    cc_t cc;
+    cc_t cc;        /* valid unless cc_lazy, use get_cc() */
+    bool_t cc_lazy; /* cc is still to be computed from the last ALU op */
+    alu_t cc_op;
+    long_t cc_argA;
+    long_t cc_argB;
+    long_t cc_val;
+    icache_t *ic;
+    FILE *out;      /* where errors and reports go, stdout by default */
+    prof_t *prof;   /* run_profile engine: counts, NULL otherwise */
 } y86sim_t;
 
+/* checkpoint of a y86sim_t: shares memory pages with it until either
+ * side stores to them (copy on write) */
+typedef struct snapshot {
+    long_t pc;
+    cc_t cc;
+    mem_t *r;
+    mem_t *m;
+} snapshot_t;
+
+typedef stat_t (*engine_t)(y86sim_t *sim, int max_steps, int *steps);
+
+/* y86sim.c */
+y86sim_t *new_y86sim(long long slen);
+void free_y86sim(y86sim_t *sim);
+int sim_file(y86sim_t *sim, char *fname, engine_t run, int max_steps);
+long_t get_reg_val(mem_t *r, regid_t id);
+void set_reg_val(mem_t *r, regid_t id, long_t val);
+cc_t get_cc(y86sim_t *sim);
+void set_cc(y86sim_t *sim, cc_t cc);
+stat_t nexti(y86sim_t *sim);
+snapshot_t *take_snapshot(y86sim_t *sim);
+void restore_snapshot(y86sim_t *sim, snapshot_t *snap);
+bool_t diff_snapshot(snapshot_t *snap, y86sim_t *sim, FILE *outfile);
+void free_snapshot(snapshot_t *snap);
+void icache_init(y86sim_t *sim);
+void icache_flush(y86sim_t *sim);
+block_t *find_block(y86sim_t *sim, long_t pc, void **labels);
+stat_t run_switch(y86sim_t *sim, int max_steps, int *steps);
+stat_t prof_nexti(y86sim_t *sim);
+
+/* y86jit.c (x86-64 hosts only) */
+#ifdef __x86_64__
+#define HAS_JIT
+stat_t run_jit(y86sim_t *sim, int max_steps, int *steps);
+void jit_free(icache_t *ic);
+#endif
+
+/* y86prof.c */
+prof_t *prof_new(void);
+void prof_free(prof_t *p);
+void prof_exec(prof_t *p, long_t pc, byte_t code);
+void prof_jump(prof_t *p, long_t pc, bool_t taken);
+void prof_mem(prof_t *p, long_t addr, bool_t write);
+void prof_report(prof_t *p, char *bin, FILE *out);
+
+/* y86batch.c */
+int run_batch(char *manifest, int threads, engine_t run, long long mem_size);
+
 #endif
 
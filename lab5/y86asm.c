@@ -2,23 +2,138 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stddef.h>
+#include <limits.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "y86asm.h"
 
-line_t *y86bin_listhead = NULL;   /* the head of y86 binary code line list*/
-line_t *y86bin_listtail = NULL;   /* the tail of y86 binary code line list*/
-int y86asm_lineno = 0; /* the current line number of y86 assemble code */
+/*
+ * The state of one assembly is thread-local: with several input files,
+ * each thread assembles its own (see assemble_files())
+ */
+__thread line_t *y86bin_listhead = NULL;   /* the head of y86 binary code line list*/
+__thread line_t *y86bin_listtail = NULL;   /* the tail of y86 binary code line list*/
+__thread int y86asm_lineno = 0; /* the current line number of y86 assemble code */
+__thread char *y86asm_fname = NULL; /* file being assembled, when there are several */
+__thread FILE *y86asm_err = NULL;   /* where errors go, stderr if NULL */
 
+#define ERR_FILE (y86asm_err ? y86asm_err : stderr)
 #define err_print(_s, _a ...) do { \
+  flockfile(ERR_FILE); \
+  if (y86asm_fname) \
+    fprintf(ERR_FILE, "%s: ", y86asm_fname); \
   if (y86asm_lineno < 0) \
-    fprintf(stderr, "[--]: "_s"\n", ## _a); \
+    fprintf(ERR_FILE, "[--]: "_s"\n", ## _a); \
   else \
-    fprintf(stderr, "[L%d]: "_s"\n", y86asm_lineno, ## _a); \
+    fprintf(ERR_FILE, "[L%d]: "_s"\n", y86asm_lineno, ## _a); \
+  funlockfile(ERR_FILE); \
 } while (0);
 
-int vmaddr = 0;    /* vm addr */
-int max_used_addr = 0;
-int jump_pos[MAX_INSLEN], jump_lineno[MAX_INSLEN], jump_pos_pointer=0;
+/*
+ * arena: lines, symbol names and relocations live until finit(), so they
+ * are bump-allocated from a list of chunks freed all at once; tokens only
+ * live for one line, in an arena that is reset after each line
+ */
+__thread arena_t arena = { NULL };
+__thread arena_t tokens = { NULL };
+__thread char *y86asm_text = NULL;   /* the whole source, lines point into it */
+
+#define ARENA_ALIGN 8
+#define CHUNK_HDR ((sizeof(chunk_t) + ARENA_ALIGN-1) & ~(ARENA_ALIGN-1))
+
+void *arena_alloc(arena_t *a, size_t size)
+{
+    chunk_t *c = a->head;
+    void *p;
+
+    size = (size + ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1);
+    if (!c || c->used + size > c->size) {
+        c = (chunk_t *)malloc(CHUNK_HDR + (size > ARENA_CHUNK ? size : ARENA_CHUNK));
+        c->size = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        c->used = 0;
+        c->next = a->head;
+        a->head = c;
+    }
+    p = (char *)c + CHUNK_HDR + c->used;
+    c->used += size;
+    return p;
+}
+
+/* copy of the 'len' chars at 's', NUL-terminated */
+char *arena_strndup(arena_t *a, char *s, int len)
+{
+    char *p = (char *)arena_alloc(a, len + 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+/* forget everything allocated from 'a', keeping its newest chunk */
+void arena_reset(arena_t *a)
+{
+    chunk_t *c;
+
+    if (!a->head)
+        return;
+    while ((c = a->head->next)) {
+        a->head->next = c->next;
+        free(c);
+    }
+    a->head->used = 0;
+}
+
+void arena_free(arena_t *a)
+{
+    chunk_t *c;
+    while ((c = a->head)) {
+        a->head = c->next;
+        free(c);
+    }
+}
+
+/*
+ * streaming mode (no listing asked for): each line is parsed and emitted
+ * into the image right away, without keeping the source
+ */
+__thread bool_t streaming = FALSE;
+__thread bool_t keep_relocs = FALSE;  /* object: record every reference */
+__thread int stream_reloc = -1;      /* symbol referenced by the current line */
+__thread patch_t *patches = NULL;    /* in order of reference */
+__thread int patch_cnt = 0, patch_size = 0;
+
+/* the binary image, grown as lines are emitted */
+__thread byte_t *image = NULL;
+__thread int image_size = 0;
+__thread int image_end = 0;      /* end of the last line emitted (the file size) */
+
+__thread int vmaddr = 0;    /* vm addr */
+#define MAX_ADDR INT_MAX    /* end of the largest image */
+__thread int max_used_addr = 0;
+
+/*
+ * numeric jXX/call destinations, checked against the final vmaddr; only a
+ * destination above all earlier ones can be the first one out of range,
+ * so only those are kept
+ */
+__thread int *jump_pos = NULL, *jump_lineno = NULL, jump_pos_pointer = 0;
+__thread int jump_pos_size = 0;
+
+void add_jump(int pos)
+{
+    if (jump_pos_pointer && pos <= jump_pos[jump_pos_pointer-1])
+        return;
+    if (jump_pos_pointer == jump_pos_size) {
+        jump_pos_size = jump_pos_size ? 2*jump_pos_size : 64;
+        jump_pos = (int *)realloc(jump_pos, jump_pos_size * sizeof(int));
+        jump_lineno = (int *)realloc(jump_lineno, jump_pos_size * sizeof(int));
+    }
+    jump_lineno[jump_pos_pointer] = y86asm_lineno;
+    jump_pos[jump_pos_pointer++] = pos;
+}
 /* register table */
 reg_t reg_table[REG_CNT] = {
     {"%eax", REG_EAX},
@@ -31,15 +146,24 @@ reg_t reg_table[REG_CNT] = {
     {"%edi", REG_EDI},
 };
 
-regid_t find_register(char *name)
+/*
+ * reg_hash: reg_table index of the register named "%e" xy, at slot
+ * (x + 3*y) & 15 (no two registers share a slot), -1 for none
+ */
+static const signed char reg_hash[16] = {
+    -1, -1, 5, 4, -1, -1, -1, -1, -1, 0, 3, 1, 2, -1, 6, 7
+};
+
+/* find the register of the 'len' chars at 'name' */
+regid_t find_register(char *name, int len)
 {
-    int i = 0;
-    while(i<8)
-    {
-        if(strcmp(name,reg_table[i].name)==0)
-            return reg_table[i].id;
-        i++;
-    }
+    int i;
+
+    if (len != 4 || name[0] != '%' || name[1] != 'e')
+        return REG_ERR;
+    i = reg_hash[(name[2] + 3*name[3]) & 15];
+    if (i >= 0 && !memcmp(name, reg_table[i].name, 4))
+        return reg_table[i].id;
     return REG_ERR;
 }
 
@@ -80,46 +204,214 @@ instr_t instr_set[] = {
     {NULL, 1,    0   , 0 } //end
 };
 
-instr_t *find_instr(char *name)
+#define INSTR_CNT 32
+
+/*
+ * instr_hash: instr_set index of the instruction named s (of length n), at
+ * slot (s[0] + 2*s[1] + 5*s[n-2] + 6*s[n-1]) & 63, a perfect hash of the
+ * names above (recompute it when instr_set changes), -1 for none
+ */
+static const signed char instr_hash[64] = {
+    -1,  6, -1, -1, -1, 16, 26, 31, -1, 23, 20, -1, -1, -1, -1, 13,
+    -1, -1, -1,  4, 27, -1, 29,  0, 15, 21, -1, -1, 18, -1,  7, -1,
+    -1, -1, 10,  9, 19, 12, -1, 11, -1,  5, 25, 30,  2, 24, 28, -1,
+    -1, -1, -1, -1, 22,  8, -1,  3, -1, 14, -1, -1, 17, -1,  1, -1
+};
+
+/* find the instruction of the 'len' chars at 'name' (the end entry if none) */
+instr_t *find_instr(char *name, int len)
 {
-    int i =0;
-    while(i<32)
+    int i;
+
+    if (len < 2)
+        return &instr_set[INSTR_CNT];
+    i = instr_hash[(name[0] + 2*name[1] + 5*name[len-2] + 6*name[len-1]) & 63];
+    if (i >= 0 && instr_set[i].len == len && !memcmp(name, instr_set[i].name, len))
+        return &instr_set[i];
+    return &instr_set[INSTR_CNT];
+}
+
+int save_data_to_bin(bin_t *y86bin, int *codes_pos ,int value, int length)
+{
+    int mark = 0xff;
+    while(length>0)
     {
-        if(strcmp(instr_set[i].name,name)==0)
-        {
-            return &instr_set[i];
+        y86bin->codes[(*codes_pos)++] = value & mark;
+        value >>= 8;
+        length--;
+    }
+    if(value > 0)
+        return 0;
+    return 1;
+}
+
+/*
+ * image_put: write the 'bytes' codes of a line at 'addr' of the image
+ *
+ * return
+ *     0: success
+ *     -1: error, the address is out of range or the image can't grow
+ */
+int image_put(int addr, byte_t *codes, int bytes)
+{
+    size_t end = (size_t)addr + bytes, size;
+    byte_t *grown;
+
+    if (addr < 0 || bytes < 0 || addr > MAX_ADDR - bytes) {
+        err_print("Invalid address 0x%x", addr);
+        return -1;
+    }
+    if (end > (size_t)image_size) {
+        size = image_size ? image_size : 4096;
+        while (size < end)
+            size = size > MAX_ADDR / 2 ? (size_t)MAX_ADDR : 2*size;
+        grown = (byte_t *)realloc(image, size);
+        if (!grown) {
+            err_print("Out of memory for a %lu-byte image", (unsigned long)size);
+            return -1;
         }
-        i++;
+        image = grown;
+        memset(image + image_size, 0, size - image_size);
+        image_size = size;
+    }
+    memcpy(image + addr, codes, bytes);
+    return 0;
+}
+
+/* store symbol address 'addr' in the address field of 'y86bin' */
+void fill_symbol(bin_t *y86bin, int addr)
+{
+    int codes_pos = 0;
+
+    switch(y86bin->bytes)
+    {
+        //.byte
+        case 1:
+            save_data_to_bin(y86bin, &codes_pos, addr, 1);
+            break;
+        //.word
+        case 2:
+            save_data_to_bin(y86bin, &codes_pos, addr, 2);
+            break;
+        //.long
+        case 4:
+            save_data_to_bin(y86bin, &codes_pos, addr, 4);
+            break;
+        //jxx,call
+        case 5:
+            codes_pos = 1;
+            save_data_to_bin(y86bin, &codes_pos, addr, 4);
+            break;
+        //irmovl
+        case 6:
+            codes_pos = 2;
+            save_data_to_bin(y86bin, &codes_pos, addr, 4);
+            break;
     }
-    return &instr_set[32];
 }
 
-/* symbol table (don't forget to init and finit it) */
-symbol_t *symtab = NULL;
+/*
+ * symbol table (don't forget to init and finit it): symbols in order of
+ * first use, found through an open-addressing hash of their names
+ */
+__thread symbol_t *symtab = NULL;
+__thread int symtab_cnt = 0, symtab_size = 0;
+__thread int *symhash = NULL;    /* index into symtab, -1 if free */
+__thread int symhash_size = 0;   /* a power of 2, at least twice symtab_cnt */
+
+/* FNV-1a hash of a symbol name */
+static unsigned hash_name(char *name)
+{
+    unsigned h = 2166136261u;
+    while (*name)
+        h = (h ^ (byte_t)*name++) * 16777619u;
+    return h;
+}
+
+/* slot of 'name' in symhash: its index, or the free slot to put it in */
+static int *hash_slot(char *name)
+{
+    unsigned i = hash_name(name) & (symhash_size-1);
+    while (symhash[i] >= 0 && strcmp(symtab[symhash[i]].name, name))
+        i = (i+1) & (symhash_size-1);
+    return &symhash[i];
+}
+
+/* double the hash table and put every symbol back in */
+static void grow_symhash(void)
+{
+    int i;
+
+    symhash_size = symhash_size ? 2*symhash_size : 256;
+    free(symhash);
+    symhash = (int *)malloc(symhash_size * sizeof(int));
+    memset(symhash, -1, symhash_size * sizeof(int));
+    for (i = 0; i < symtab_cnt; i++)
+        *hash_slot(symtab[i].name) = i;
+}
+
+/*
+ * intern_symbol: find the symbol named 'name', or add it as undefined
+ * args
+ *     name: the name of symbol (copied if new)
+ *
+ * return
+ *     the index of the symbol in symtab
+ */
+int intern_symbol(char *name)
+{
+    int *slot = hash_slot(name);
+
+    if (*slot >= 0)
+        return *slot;
+    if (symtab_cnt == symtab_size) {
+        symtab_size = symtab_size ? 2*symtab_size : 256;
+        symtab = (symbol_t *)realloc(symtab, symtab_size * sizeof(symbol_t));
+    }
+    symtab[symtab_cnt].name = arena_strndup(&arena, name, strlen(name));
+    symtab[symtab_cnt].addr = 0;
+    symtab[symtab_cnt].defined = FALSE;
+    symtab[symtab_cnt].patches = -1;
+    *slot = symtab_cnt++;
+    if (2*symtab_cnt > symhash_size)
+        grow_symhash();
+    return symtab_cnt-1;
+}
 
 /*
- * find_symbol: scan table to find the symbol
+ * find_symbol: look the symbol up in the table
  * args
  *     name: the name of symbol
  *
  * return
  *     symbol_t: the 'name' symbol
- *     NULL: not exist
+ *     NULL: not defined
  */
 symbol_t *find_symbol(char *name)
 {
-    symbol_t *head = symtab->next;
-    while(head)
-    {
-        if(strcmp(head->name,name)==0)
-            return head;
-        head = head->next;
+    int i = *hash_slot(name);
+    if (i < 0 || !symtab[i].defined)
+        return NULL;
+    return &symtab[i];
+}
+
+/* streaming: fill the pending references to 'symbol', now defined */
+void resolve_patches(symbol_t *symbol)
+{
+    patch_t *p;
+    bin_t y86bin;
+
+    for (; symbol->patches >= 0; symbol->patches = p->next) {
+        p = &patches[symbol->patches];
+        y86bin.bytes = p->bytes;
+        memcpy(y86bin.codes, image + p->addr, p->bytes);
+        fill_symbol(&y86bin, symbol->addr);
+        image_put(p->addr, y86bin.codes, p->bytes);
     }
-    return NULL;
 }
 
 /*
- * add_symbol: add a new symbol to the symbol table
+ * add_symbol: define a symbol at the current address
  * args
  *     name: the name of symbol
  *
@@ -129,57 +421,143 @@ symbol_t *find_symbol(char *name)
  */
 int add_symbol(char *name)
 {    
+    int i = *hash_slot(name);
+    symbol_t *symbol;
+
     /* check duplicate */
-    if(find_symbol(name)!=NULL)
+    if (i >= 0 && symtab[i].defined)
         return -1;
-    /* create new symbol_t (don't forget to free it)*/
-    symbol_t* symbol = (symbol_t*)malloc(sizeof(symbol_t));
-    symbol->name = name;
+    i = intern_symbol(name);
+    symbol = &symtab[i];
     symbol->addr = vmaddr;
-    symbol->next = NULL;
-    /* add the new symbol_t to symbol table */
-    symbol->next = symtab->next;
-    symtab->next = symbol;
+    symbol->defined = TRUE;
+    if (streaming)
+        resolve_patches(symbol);
     return 0;
 }
 
 /* relocation table (don't forget to init and finit it) */
-reloc_t *reltab = NULL;
+__thread reloc_t *reltab = NULL;
 
 /*
  * add_reloc: add a new relocation to the relocation table
+ *     (streaming: just note the symbol, see emit_line())
  * args
  *     name: the name of symbol
- *
- * return
- *     0: success
- *     -1: error, the symbol has exist
+ *     bin: the binary code to patch with the address of the symbol
  */
 void add_reloc(char *name, bin_t *bin)
 {
-    /* create new reloc_t (don't forget to free it)*/
-    reloc_t* reloc = (reloc_t*)malloc(sizeof(reloc_t));
+    if (streaming) {
+        stream_reloc = intern_symbol(name);
+        return;
+    }
+
+    /* create new reloc_t (freed with the arena) */
+    reloc_t* reloc = (reloc_t*)arena_alloc(&arena, sizeof(reloc_t));
     reloc->y86bin = bin;
-    reloc->name = name;
-    reloc->next = NULL;
+    reloc->sym = intern_symbol(name);
     /* add the new reloc_t to relocation table */
     reloc->next = reltab->next;
     reltab->next = reloc;
 }
 
 
+/* character classes, one table lookup per char */
+#define CC_DIGIT    0x01    /* starts a number: 0-9, '-', '+' */
+#define CC_LETTER   0x02
+#define CC_BLANK    0x04
+#define CC_NL       0x08
+#define CC_COMMA    0x10
+#define CC_COLON    0x20
+#define CC_RPAREN   0x40
+#define CC_END      0x80
+
+static const unsigned char char_class[256] = {
+    ['0' ... '9'] = CC_DIGIT, ['-'] = CC_DIGIT, ['+'] = CC_DIGIT,
+    ['a' ... 'z'] = CC_LETTER, ['A' ... 'Z'] = CC_LETTER,
+    [' '] = CC_BLANK, ['\t'] = CC_BLANK, ['\n'] = CC_NL,
+    [','] = CC_COMMA, [':'] = CC_COLON, [')'] = CC_RPAREN, ['\0'] = CC_END,
+};
+
+/* chars that end an instruction name, a register and a symbol or label */
+#define INSTR_END   (CC_BLANK | CC_NL | CC_END)
+#define REG_END     (CC_RPAREN | CC_COMMA | CC_BLANK | CC_NL | CC_END)
+#define SYMBOL_END  (CC_COLON | CC_COMMA | CC_BLANK | CC_NL | CC_END)
+
+#define CLASS(s) (char_class[(unsigned char)*(s)])
+
+/* length of the token at 's', which ends at a char of class 'end' */
+static inline int token_len(char *s, int end)
+{
+    char *p = s;
+    while (!(CLASS(p) & end))
+        p++;
+    return p - s;
+}
+
+/* value of a digit in any base up to 16, 99 if not a digit */
+static const unsigned char digit_value[256] = {
+    [0 ... 255] = 99,
+    ['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
+    ['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+    ['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+    ['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
+/*
+ * parse_number: read the number at 's' in one pass, exactly as
+ *     strtoll(s, end, 0) does: blanks, a sign, then hex after "0x", octal
+ *     after "0", decimal otherwise, saturated when out of range
+ *
+ * return
+ *     the value; *end is set after it (to 's' if there is no number)
+ */
+static long long parse_number(char *s, char **end)
+{
+    unsigned long long value = 0, limit = LLONG_MAX;
+    bool_t neg = FALSE, any = FALSE, over = FALSE;
+    char *p = s;
+    int base = 10, d;
+
+    while (*p == ' ' || (*p >= '\t' && *p <= '\r'))
+        p++;
+    if (*p == '-' || *p == '+')
+        neg = (*p++ == '-');
+    if (neg)
+        limit++;
+    if (*p == '0') {
+        base = 8;
+        if ((p[1] == 'x' || p[1] == 'X') && digit_value[(unsigned char)p[2]] < 16) {
+            base = 16;
+            p += 2;
+        }
+    }
+    for (; (d = digit_value[(unsigned char)*p]) < base; p++) {
+        any = TRUE;
+        if (value > (limit - d) / base)
+            over = TRUE;
+        else
+            value = value * base + d;
+    }
+    *end = any ? p : s;
+    if (over)
+        return neg ? LLONG_MIN : LLONG_MAX;
+    return neg ? (long long)(0 - value) : (long long)value;
+}
+
 /* macro for parsing y86 assembly code */
-#define IS_DIGIT(s) ((*(s)>='0' && *(s)<='9') || *(s)=='-' || *(s)=='+')
-#define IS_LETTER(s) ((*(s)>='a' && *(s)<='z') || (*(s)>='A' && *(s)<='Z'))
+#define IS_DIGIT(s) (CLASS(s) & CC_DIGIT)
+#define IS_LETTER(s) (CLASS(s) & CC_LETTER)
 #define IS_COMMENT(s) (*(s)=='#')
 #define IS_REG(s) (*(s)=='%')
 #define IS_IMM(s) (*(s)=='$')
 #define IS_LABEL(s) (*(s)=='.')
-#define IS_BLANK(s) (*(s)==' ' || *(s)=='\t')
+#define IS_BLANK(s) (CLASS(s) & CC_BLANK)
 #define IS_END(s) (*(s)=='\0')
 
 #define SKIP_BLANK(s) do {  \
-  while(!IS_END(s) && IS_BLANK(s))  \
+  while(IS_BLANK(s))  \
     (s)++;    \
 } while(0);
 
@@ -205,13 +583,10 @@ parse_t parse_instr(char **ptr, instr_t **inst)
     SKIP_BLANK(*ptr);
     if(IS_END(*ptr)) return PARSE_ERR;
     /* find_instr and check end */
-    char* next_pos = strpbrk(*ptr," \t\n\0");
-    int name_len = next_pos?next_pos-*ptr:strlen(*ptr);
-    char* name = (char*)malloc(name_len+1); 
-    strncpy(name, *ptr, name_len);
+    int name_len = token_len(*ptr, INSTR_END);
     
     /* set 'ptr' and 'inst' */
-    *inst = find_instr(name);
+    *inst = find_instr(*ptr, name_len);
     if(*inst != NULL)
     {
         *ptr = (*ptr) + (*inst)->len;
@@ -261,17 +636,13 @@ parse_t parse_reg(char **ptr, regid_t *regid)
     SKIP_BLANK(*ptr);
     if(IS_END(*ptr))
         return PARSE_ERR;
-    char* next_pos = strpbrk(*ptr,"), \t\n\0");
-    int name_len = next_pos?next_pos-*ptr:strlen(*ptr);
-    char* name = (char*)malloc(name_len+1); 
-    strncpy(name, *ptr, name_len);
+    int name_len = token_len(*ptr, REG_END);
     /* find register */
-    *regid = find_register(name); 
+    *regid = find_register(*ptr, name_len);
     if(*regid == REG_ERR)
         return PARSE_ERR;
     /* set 'ptr' and 'regid' */
     *ptr += name_len;
-    free(name);
     return PARSE_REG;
 }
 
@@ -294,10 +665,8 @@ parse_t parse_symbol(char **ptr, char **name)
     if(IS_END(*ptr))
         return PARSE_ERR;
     /* allocate name and copy to it */
-    char* next_pos = strpbrk(*ptr,":, \t\n\0");
-    int name_len = next_pos?next_pos-*ptr:strlen(*ptr);
-    *name = (char*)malloc(name_len+1); 
-    strncpy(*name, *ptr, name_len);
+    int name_len = token_len(*ptr, SYMBOL_END);
+    *name = arena_strndup(&tokens, *ptr, name_len);
     /* set 'ptr' and 'name' */
     *ptr = (*ptr) + name_len;
     return PARSE_SYMBOL;
@@ -323,8 +692,8 @@ parse_t parse_digit(char **ptr, long *value)
     if(IS_BLANK(*ptr))
         return PARSE_ERR;
     /* calculate the digit, (NOTE: see strtoll()) */
-    /* ptr is set to new value in strtoll*/
-    *value = strtoll(*ptr,ptr,0);
+    /* ptr is set to new value in parse_number*/
+    *value = parse_number(*ptr,ptr);
     /* set 'ptr' and 'value' */
     return PARSE_DIGIT;
 }
@@ -470,36 +839,19 @@ parse_t parse_label(char **ptr, char **name)
     if(IS_END(*ptr))
         return PARSE_ERR;
     /* allocate name and copy to it */
-    char* next_pos = strpbrk(*ptr,",: \t\n\0");
-    int name_len = next_pos?next_pos-*ptr:strlen(*ptr);
-    *name = (char*)malloc(name_len+1); 
-    strncpy(*name, *ptr, name_len);
+    int name_len = token_len(*ptr, SYMBOL_END);
     
-    /* set 'ptr' and 'name' */
-    if(find_instr(*name)->name == NULL)
+    /* set 'ptr' and 'name' (only copied if it is a label) */
+    if(find_instr(*ptr, name_len)->name == NULL)
     {
+        *name = arena_strndup(&tokens, *ptr, name_len);
         *ptr += name_len+1; // the lenth count ':'
         return PARSE_LABEL;
     }
-    free(*name);
     *name = NULL;
     return PARSE_ERR;
 }
 
-int save_data_to_bin(bin_t *y86bin, int *codes_pos ,int value, int length)
-{
-    int mark = 0xff;
-    while(length>0)
-    {
-        y86bin->codes[(*codes_pos)++] = value & mark;
-        value >>= 8;
-        length--;
-    }
-    if(value > 0)
-        return 0;
-    return 1;
-}
-
 /*
  * parse_line: parse a line of y86 code (e.g., 'Loop: mrmovl (%ecx), %esi')
  * (you could combine above parse_xxx functions to do it)
@@ -592,13 +944,17 @@ type_t parse_line(line_t *line)
                         break;
 
                     case D_POS:
-                        if(parse_digit(&asmPointer, &pos) == PARSE_DIGIT)
-                            vmaddr = pos;
-                        else
+                        if(parse_digit(&asmPointer, &pos) != PARSE_DIGIT)
                         {
                             err_print("Invalid Immediate");
                             return line->type = TYPE_ERR;
                         }
+                        if(pos < 0 || pos > MAX_ADDR)
+                        {
+                            err_print("Invalid address %ld", pos);
+                            return line->type = TYPE_ERR;
+                        }
+                        vmaddr = pos;
                         break;
                     default:
                         return line->type = TYPE_ERR;
@@ -715,8 +1071,7 @@ type_t parse_line(line_t *line)
                         break;
                     case PARSE_DIGIT:
                         save_data_to_bin(&(line->y86bin), &codes_pos, tmp_value,4);
-                        jump_lineno[jump_pos_pointer] = y86asm_lineno;
-                        jump_pos[jump_pos_pointer++] = tmp_value;
+                        add_jump(tmp_value);
                         break;
                     default:
                         return line->type = TYPE_ERR;
@@ -798,39 +1153,90 @@ type_t parse_line(line_t *line)
                 return line->type = TYPE_ERR;
         }
     }
+    /* .align may have wrapped, and the line must fit below MAX_ADDR */
+    if (vmaddr < 0 || vmaddr > MAX_ADDR - line->y86bin.bytes) {
+        err_print("Address out of range");
+        return line->type = TYPE_ERR;
+    }
     line->y86bin.addr = vmaddr;
     vmaddr += line->y86bin.bytes;
     return line->type;
 }
 
 /*
- * assemble: assemble an y86 file (e.g., 'asum.ys')
- * args
- *     in: point to input file (an y86 assembly file)
+ * read_source: read all of 'in' into y86asm_text (freed in finit)
  *
  * return
- *     0: success, assmble the y86 file to a list of line_t
+ *     the number of chars read, -1 on a read error
+ */
+static long read_source(FILE *in)
+{
+    size_t len = 0, size = MAX_INSLEN, n;
+    char *grown;
+
+    y86asm_text = (char *)malloc(size + 1);
+    while ((n = fread(y86asm_text + len, 1, size - len, in)) > 0) {
+        len += n;
+        if (len == size) {
+            if (size > LONG_MAX / 2)
+                return -1;
+            size *= 2;
+            grown = (char *)realloc(y86asm_text, size + 1);
+            if (!grown)
+                return -1;
+            y86asm_text = grown;
+        }
+    }
+    if (ferror(in))
+        return -1;
+    y86asm_text[len] = '\0';
+    return len;
+}
+
+/* report a numeric jXX/call destination beyond the end of the code */
+static int check_jumps(void)
+{
+    int i=0;
+    while(i<jump_pos_pointer)
+    {
+        if(jump_pos[i]>vmaddr)
+        {
+            y86asm_lineno = jump_lineno[i];
+            err_print("Invalid DEST");
+            return -1;
+        }
+        i++;
+    }
+    /* skip line number information in err_print() */
+    y86asm_lineno = -1;
+    return 0;
+}
+
+/*
+ * assemble_text: assemble the 'len' chars of y86asm_text to a list of line_t
+ *
+ * return
+ *     0: success
  *     -1: error, try to print err information (e.g., instr type and line number)
  */
-int assemble(FILE *in)
+static int assemble_text(long len)
 {
-    static char asm_buf[MAX_INSLEN]; /* the current line of asm code */
     line_t *line;
-    int slen;
-    char *y86asm;
-
-    /* read y86 code line-by-line, and parse them to generate raw y86 binary code list */
-    while (fgets(asm_buf, MAX_INSLEN, in) != NULL) {
-        slen  = strlen(asm_buf);
-        if ((asm_buf[slen-1] == '\n') || (asm_buf[slen-1] == '\r')) { 
-            asm_buf[--slen] = '\0'; /* replace terminator */
+    char *y86asm, *end, *eol;
+
+    /* split the source into lines in place, and parse them to generate raw y86 binary code list */
+    end = y86asm_text + len;
+    for (y86asm = y86asm_text; y86asm < end; y86asm = eol + 1) {
+        eol = (char *)memchr(y86asm, '\n', end - y86asm);
+        if (!eol) {
+            /* last line without a newline */
+            eol = end;
+            if (eol[-1] == '\r')
+                eol[-1] = '\0';
         }
+        *eol = '\0'; /* replace terminator */
 
-        /* store y86 assembly code */
-        y86asm = (char *)malloc(sizeof(char) * (slen + 1)); // free in finit
-        strcpy(y86asm, asm_buf);
-
-        line = (line_t *)malloc(sizeof(line_t)); // free in finit
+        line = (line_t *)arena_alloc(&arena, sizeof(line_t)); // freed with the arena
         memset(line, '\0', sizeof(line_t));
 
         /* set defualt */
@@ -846,23 +1252,106 @@ int assemble(FILE *in)
         /* parse */
         if (parse_line(line) == TYPE_ERR)
             return -1;
+        arena_reset(&tokens);
     }
-    int i=0;
-    while(i<jump_pos_pointer)
-    {
-        if(jump_pos[i]>vmaddr)
-        {
-            y86asm_lineno = jump_lineno[i];
-            err_print("Invalid DEST");
-            return -1;
+    return check_jumps();
+}
+
+/*
+ * assemble: assemble an y86 file (e.g., 'asum.ys')
+ * args
+ *     in: point to input file (an y86 assembly file)
+ *
+ * return
+ *     0: success, assmble the y86 file to a list of line_t
+ *     -1: error, try to print err information (e.g., instr type and line number)
+ */
+int assemble(FILE *in)
+{
+    long len = read_source(in);
+
+    if (len < 0) {
+        err_print("Can't read input file");
+        return -1;
+    }
+    return assemble_text(len);
+}
+
+/* streaming: put the parsed 'line' into the image (-1 if it can't be) */
+static int emit_line(line_t *line)
+{
+    bin_t *y86bin = &line->y86bin;
+    symbol_t *symbol;
+    patch_t *p;
+
+    if (stream_reloc >= 0) {
+        symbol = &symtab[stream_reloc];
+        stream_reloc = -1;
+        if (symbol->defined)
+            fill_symbol(y86bin, symbol->addr);
+        if ((!symbol->defined || keep_relocs) && y86bin->addr >= 0) {
+            /* forward reference: patched by add_symbol() */
+            if (patch_cnt == patch_size) {
+                patch_size = patch_size ? 2*patch_size : 256;
+                patches = (patch_t *)realloc(patches, patch_size * sizeof(patch_t));
+            }
+            p = &patches[patch_cnt];
+            p->addr = y86bin->addr;
+            p->bytes = y86bin->bytes;
+            p->sym = symbol - symtab;
+            p->next = -1;
+            if (!symbol->defined) {
+                p->next = symbol->patches;
+                symbol->patches = patch_cnt;
+            }
+            patch_cnt++;
         }
-        i++;
     }
-    /* skip line number information in err_print() */
-    y86asm_lineno = -1;
+    if (line->type != TYPE_INS || y86bin->bytes == 0)
+        return 0;
+    if (image_put(y86bin->addr, y86bin->codes, y86bin->bytes) < 0)
+        return -1;
+    image_end = y86bin->addr + y86bin->bytes;
     return 0;
 }
 
+/*
+ * assemble_stream: assemble an y86 file straight into the image, one line
+ *     at a time; forward references are patched when their label is defined
+ * args
+ *     in: point to input file (an y86 assembly file)
+ *
+ * return
+ *     0: success, the image is complete but for undefined symbols
+ *     -1: error, try to print err information (e.g., instr type and line number)
+ */
+int assemble_stream(FILE *in)
+{
+    line_t line;
+    char *buf = NULL;
+    size_t size = 0;
+    ssize_t slen;
+
+    while ((slen = getline(&buf, &size, in)) > 0) {
+        if ((buf[slen-1] == '\n') || (buf[slen-1] == '\r')) {
+            buf[--slen] = '\0'; /* replace terminator */
+        }
+
+        memset(&line, '\0', sizeof(line_t));
+        line.type = TYPE_COMM;
+        line.y86asm = buf;
+        y86asm_lineno ++;
+
+        if (parse_line(&line) == TYPE_ERR || emit_line(&line) < 0) {
+            free(buf);
+            return -1;
+        }
+        arena_reset(&tokens);
+    }
+    free(buf);
+    return check_jumps();
+}
+
 /*
  * relocate: relocate the raw y86 binary code with symbol address
  *
@@ -873,48 +1362,32 @@ int assemble(FILE *in)
 int relocate(void)
 {
     reloc_t *rtmp = NULL;
-    
+    int i;
+
+    if (streaming) {
+        /* references were filled as labels were defined: report the one
+         * relocate() below would have found first */
+        for (i = patch_cnt-1; i >= 0; i--)
+            if (!symtab[patches[i].sym].defined) {
+                err_print("Unknown symbol:'%s'",symtab[patches[i].sym].name);
+                return -1;
+            }
+        return 0;
+    }
+
     rtmp = reltab->next;
-    int codes_pos = 0;
     while (rtmp) {
-        /* find symbol */
-        symbol_t* symbol = find_symbol(rtmp->name);
-        if(symbol == NULL)
+        /* the symbol was interned when the reference was parsed */
+        symbol_t* symbol = &symtab[rtmp->sym];
+        if(!symbol->defined)
         {
-            err_print("Unknown symbol:'%s'",rtmp->name);
+            err_print("Unknown symbol:'%s'",symbol->name);
             return -1;
         }
         if(symbol->addr>max_used_addr)
             max_used_addr = symbol->addr;
         /* relocate y86bin according itype */
-        switch(rtmp->y86bin->bytes)
-        {
-            //.byte
-            case 1:
-                codes_pos = 0;
-                save_data_to_bin(rtmp->y86bin, &codes_pos, symbol->addr, 1);
-                break;
-            //.word
-            case 2:
-                codes_pos = 0;
-                save_data_to_bin(rtmp->y86bin, &codes_pos, symbol->addr, 2);
-                break;
-           //.long
-            case 4:
-                codes_pos=0;
-                save_data_to_bin(rtmp->y86bin, &codes_pos, symbol->addr, 4);
-                break;
-            //jxx,call
-            case 5:
-                codes_pos=1;
-                save_data_to_bin(rtmp->y86bin, &codes_pos, symbol->addr, 4);
-                break;
-            //irmovl
-            case 6:
-                codes_pos = 2;
-                save_data_to_bin(rtmp->y86bin, &codes_pos, symbol->addr,4);
-                break;
-        }
+        fill_symbol(rtmp->y86bin, symbol->addr);
         /* next */
         rtmp = rtmp->next;
     }
@@ -932,32 +1405,21 @@ int relocate(void)
  */
 int binfile(FILE *out)
 {
-    /* prepare image with y86 binary code */
-    char buf[MAX_INSLEN*6]; 
-    memset(buf,0,sizeof(char));
-    line_t *tmp = y86bin_listhead->next;
-    long pos=0;
-    while(tmp!=NULL)
-    {
-        if(tmp->y86bin.bytes==0)
-        {
-            tmp = tmp->next;
-            continue;
+    /* prepare image with y86 binary code (streaming: already done) */
+    line_t *tmp;
+
+    if (!streaming) {
+        for (tmp = y86bin_listhead->next; tmp != NULL; tmp = tmp->next) {
+            if (tmp->y86bin.bytes == 0)
+                continue;
+            if (image_put(tmp->y86bin.addr, tmp->y86bin.codes, tmp->y86bin.bytes) < 0)
+                return -1;
+            image_end = tmp->y86bin.addr + tmp->y86bin.bytes;
         }
-        pos = tmp->y86bin.addr;
-        int k = 0;
-     //   printf("%d %d\n", pos,tmp->y86bin.bytes);
-        while(k < tmp->y86bin.bytes)
-        {
-            buf[pos] = tmp->y86bin.codes[k];
-            k++;
-            pos++;
-        }
-        tmp = tmp->next;
     }
     /* binary write y86 code to output file (NOTE: see fwrite()) */
-   fwrite(buf,sizeof(char), pos,out);
-   // printf("%d %d\n",t,pos);
+    if (image_end > 0 && fwrite(image, sizeof(byte_t), image_end, out) != (size_t)image_end)
+        return -1;
     return 0;
 }
 
@@ -976,7 +1438,7 @@ static void hexstuff(char *dest, int value, int len)
     }
 }
 
-void print_line(line_t *line)
+void print_line(line_t *line, FILE *out)
 {
     char buf[26];
 
@@ -995,20 +1457,20 @@ void print_line(line_t *line)
         strcpy(buf, "                      | ");
     }
 
-    printf("%s%s\n", buf, line->y86asm);
+    fprintf(out, "%s%s\n", buf, line->y86asm);
 }
 
 /* 
- * print_screen: dump readable binary and assembly code to screen
+ * print_screen: dump readable binary and assembly code to 'out' (the screen)
  * (e.g., Figure 4.8 in ICS book)
  */
-void print_screen(void)
+void print_screen(FILE *out)
 {
     line_t *tmp = y86bin_listhead->next;
     
     /* line by line */
     while (tmp != NULL) {
-        print_line(tmp);
+        print_line(tmp, out);
         tmp = tmp->next;
     }
 }
@@ -1016,13 +1478,30 @@ void print_screen(void)
 /* init and finit */
 void init(void)
 {
-    reltab = (reloc_t *)malloc(sizeof(reloc_t)); // free in finit
+    arena.head = tokens.head = NULL;
+    y86asm_text = NULL;
+
+    reltab = (reloc_t *)arena_alloc(&arena, sizeof(reloc_t)); // freed in finit
     memset(reltab, 0, sizeof(reloc_t));
 
-    symtab = (symbol_t *)malloc(sizeof(symbol_t)); // free in finit
-    memset(symtab, 0, sizeof(symbol_t));
+    symtab = NULL; // free in finit
+    symtab_cnt = symtab_size = 0;
+    symhash = NULL;
+    symhash_size = 0;
+    grow_symhash();
+
+    streaming = keep_relocs = FALSE;
+    patches = NULL;
+    patch_cnt = patch_size = 0;
+    stream_reloc = -1;
+    image = NULL;
+    image_size = image_end = 0;
 
-    y86bin_listhead = (line_t *)malloc(sizeof(line_t)); // free in finit
+    vmaddr = max_used_addr = 0;
+    jump_pos = jump_lineno = NULL;
+    jump_pos_pointer = jump_pos_size = 0;
+
+    y86bin_listhead = (line_t *)arena_alloc(&arena, sizeof(line_t)); // freed in finit
     memset(y86bin_listhead, 0, sizeof(line_t));
     y86bin_listtail = y86bin_listhead;
     y86asm_lineno = 0;
@@ -1030,38 +1509,699 @@ void init(void)
 
 void finit(void)
 {
-    reloc_t *rtmp = NULL;
-    do {
-        rtmp = reltab->next;
-        if (reltab->name) 
-            free(reltab->name);
-        free(reltab);
-        reltab = rtmp;
-    } while (reltab);
-    
-    symbol_t *stmp = NULL;
-    do {
-        stmp = symtab->next;
-        if (symtab->name) 
-            free(symtab->name);
-        free(symtab);
-        symtab = stmp;
-    } while (symtab);
-
-    line_t *ltmp = NULL;
-    do {
-        ltmp = y86bin_listhead->next;
-        if (y86bin_listhead->y86asm) 
-            free(y86bin_listhead->y86asm);
-        free(y86bin_listhead);
-        y86bin_listhead = ltmp;
-    } while (y86bin_listhead);
+    /* lines, names and relocations all live in the arena */
+    arena_free(&arena);
+    arena_free(&tokens);
+    reltab = NULL;
+    y86bin_listhead = y86bin_listtail = NULL;
+
+    free(symtab);
+    free(symhash);
+    free(patches);
+    free(jump_pos);
+    free(jump_lineno);
+    free(image);
+    free(y86asm_text);
+}
+
+/*
+ * assemble_object: assemble 'fname' into a relocatable object
+ *
+ * return
+ *     the object, or NULL on error (after printing why)
+ */
+object_t *assemble_object(char *fname)
+{
+    object_t *obj;
+    FILE *in;
+    int i, err;
+
+    init();
+    y86asm_fname = fname;
+    in = fopen(fname, "r");
+    if (!in) {
+        y86asm_fname = NULL;
+        y86asm_lineno = -1;
+        err_print("Can't open input file '%s'", fname);
+        finit();
+        return NULL;
+    }
+    streaming = TRUE;
+    keep_relocs = TRUE;
+    err = assemble_stream(in);
+    fclose(in);
+    if (err < 0) {
+        err_print("Assemble y86 code error");
+        finit();
+        y86asm_fname = NULL;
+        return NULL;
+    }
+
+    obj = (object_t *)malloc(sizeof(object_t));
+    obj->name = fname;
+    obj->image_len = image_end;
+    obj->image = (byte_t *)malloc(image_end);
+    memcpy(obj->image, image, image_end);
+    obj->size = image_end > vmaddr ? image_end : vmaddr;
+    obj->symtab_cnt = symtab_cnt;
+    obj->symtab = (symbol_t *)malloc(symtab_cnt * sizeof(symbol_t));
+    for (i = 0; i < symtab_cnt; i++) {
+        obj->symtab[i] = symtab[i];
+        obj->symtab[i].name = strdup(symtab[i].name);
+        obj->symtab[i].patches = -1;
+        if (symtab[i].defined && symtab[i].addr > obj->size)
+            obj->size = symtab[i].addr;
+    }
+    obj->reloc_cnt = patch_cnt;
+    obj->relocs = (patch_t *)malloc(patch_cnt * sizeof(patch_t));
+    memcpy(obj->relocs, patches, patch_cnt * sizeof(patch_t));
+    obj->base = 0;
+
+    finit();
+    y86asm_fname = NULL;
+    return obj;
+}
+
+void free_object(object_t *obj)
+{
+    int i;
+    for (i = 0; i < obj->symtab_cnt; i++)
+        free(obj->symtab[i].name);
+    free(obj->symtab);
+    free(obj->relocs);
+    free(obj->image);
+    free(obj);
+}
+
+/*
+ * write_object: save 'obj' to 'out' (ints in host byte order)
+ *     "Y86O", image_len, size, symtab_cnt, reloc_cnt,
+ *     symbols: addr, defined, name length, name
+ *     relocations: addr, bytes, sym
+ *     image
+ *
+ * return
+ *     0: success
+ *     -1: error
+ */
+int write_object(object_t *obj, FILE *out)
+{
+    int i, len, hdr[4] = { obj->image_len, obj->size, obj->symtab_cnt,
+                           obj->reloc_cnt };
+
+    fwrite(OBJ_MAGIC, 1, 4, out);
+    fwrite(hdr, sizeof(int), 4, out);
+    for (i = 0; i < obj->symtab_cnt; i++) {
+        len = strlen(obj->symtab[i].name);
+        fwrite(&obj->symtab[i].addr, sizeof(int), 1, out);
+        fwrite(&obj->symtab[i].defined, sizeof(int), 1, out);
+        fwrite(&len, sizeof(int), 1, out);
+        fwrite(obj->symtab[i].name, 1, len, out);
+    }
+    for (i = 0; i < obj->reloc_cnt; i++) {
+        fwrite(&obj->relocs[i].addr, sizeof(int), 1, out);
+        fwrite(&obj->relocs[i].bytes, sizeof(int), 1, out);
+        fwrite(&obj->relocs[i].sym, sizeof(int), 1, out);
+    }
+    fwrite(obj->image, 1, obj->image_len, out);
+    return ferror(out) ? -1 : 0;
+}
+
+/*
+ * read_object: load an object saved by write_object()
+ *
+ * return
+ *     the object, or NULL on error (after printing why)
+ */
+object_t *read_object(char *fname)
+{
+    object_t *obj;
+    FILE *in = fopen(fname, "rb");
+    char magic[4];
+    int i, len, hdr[4], defined;
+    bool_t ok;
+
+    if (!in) {
+        err_print("Can't open object file '%s'", fname);
+        return NULL;
+    }
+    ok = fread(magic, 1, 4, in) == 4 && !memcmp(magic, OBJ_MAGIC, 4) &&
+         fread(hdr, sizeof(int), 4, in) == 4 &&
+         hdr[0] >= 0 && hdr[1] >= hdr[0] && hdr[2] >= 0 && hdr[3] >= 0;
+    if (!ok) {
+        err_print("Not a y86 object file '%s'", fname);
+        fclose(in);
+        return NULL;
+    }
+
+    obj = (object_t *)calloc(1, sizeof(object_t));
+    obj->name = fname;
+    obj->image_len = hdr[0];
+    obj->size = hdr[1];
+    obj->symtab_cnt = hdr[2];
+    obj->reloc_cnt = hdr[3];
+    obj->symtab = (symbol_t *)calloc(obj->symtab_cnt, sizeof(symbol_t));
+    obj->relocs = (patch_t *)calloc(obj->reloc_cnt, sizeof(patch_t));
+    obj->image = (byte_t *)malloc(obj->image_len);
+    for (i = 0; ok && i < obj->symtab_cnt; i++) {
+        ok = fread(&obj->symtab[i].addr, sizeof(int), 1, in) == 1 &&
+             fread(&defined, sizeof(int), 1, in) == 1 &&
+             fread(&len, sizeof(int), 1, in) == 1 && len >= 0;
+        obj->symtab[i].name = (char *)calloc(1, ok ? len + 1 : 1);
+        ok = ok && fread(obj->symtab[i].name, 1, len, in) == (size_t)len;
+        obj->symtab[i].defined = defined ? TRUE : FALSE;
+        obj->symtab[i].patches = -1;
+    }
+    for (i = 0; ok && i < obj->reloc_cnt; i++) {
+        ok = fread(&obj->relocs[i].addr, sizeof(int), 1, in) == 1 &&
+             fread(&obj->relocs[i].bytes, sizeof(int), 1, in) == 1 &&
+             fread(&obj->relocs[i].sym, sizeof(int), 1, in) == 1 &&
+             obj->relocs[i].sym >= 0 && obj->relocs[i].sym < obj->symtab_cnt &&
+             /* the field must lie within the image */
+             obj->relocs[i].bytes > 0 && obj->relocs[i].bytes <= 6 &&
+             obj->relocs[i].addr >= 0 &&
+             obj->relocs[i].addr <= obj->image_len - obj->relocs[i].bytes;
+        obj->relocs[i].next = -1;
+    }
+    ok = ok && fread(obj->image, 1, obj->image_len, in) == (size_t)obj->image_len;
+    fclose(in);
+    if (!ok) {
+        err_print("Corrupt y86 object file '%s'", fname);
+        free_object(obj);
+        return NULL;
+    }
+    return obj;
+}
+
+/*
+ * link_objects: place 'objs' one after the other from address 0 and fill
+ *     every reference: to a symbol of the same object if it has one, else
+ *     to the one object that defines it
+ * args
+ *     out: the .bin file to write
+ *
+ * return
+ *     0: success
+ *     -1: error, try to print err information (e.g., symbol and file)
+ */
+int link_objects(object_t **objs, int n, FILE *out)
+{
+    object_t *obj;
+    symbol_t *symbol;
+    patch_t *r;
+    bin_t y86bin;
+    int *owner = NULL;  /* per global symbol: defining object, -1 if several */
+    int i, k, g, base = 0, end = 0, err = 0;
+
+    /* the global symbol table is this thread's symtab, and the objects
+     * are laid out in its image */
+    init();
+    streaming = TRUE;
+    y86asm_lineno = -1;
+    for (k = 0; k < n; k++) {
+        obj = objs[k];
+        obj->base = base;
+        base += (obj->size + OBJ_ALIGN-1) / OBJ_ALIGN * OBJ_ALIGN;
+        for (i = 0; i < obj->symtab_cnt; i++) {
+            if (!obj->symtab[i].defined)
+                continue;
+            g = intern_symbol(obj->symtab[i].name);
+            owner = (int *)realloc(owner, symtab_cnt * sizeof(int));
+            if (symtab[g].defined)
+                owner[g] = -1;
+            else {
+                owner[g] = k;
+                symtab[g].defined = TRUE;
+                symtab[g].addr = obj->base + obj->symtab[i].addr;
+            }
+        }
+        if (image_put(obj->base, obj->image, obj->image_len) < 0) {
+            err = -1;
+            break;
+        }
+        if (obj->image_len > 0)
+            end = obj->base + obj->image_len;
+    }
+
+    for (k = 0; !err && k < n; k++) {
+        obj = objs[k];
+        y86asm_fname = obj->name;
+        /* same order as relocate() */
+        for (i = obj->reloc_cnt-1; !err && i >= 0; i--) {
+            r = &obj->relocs[i];
+            symbol = &obj->symtab[r->sym];
+            if (symbol->defined)
+                g = obj->base + symbol->addr;
+            else if ((g = *hash_slot(symbol->name)) < 0) {
+                err_print("Unknown symbol:'%s'", symbol->name);
+                err = -1;
+                break;
+            } else if (owner[g] < 0) {
+                err_print("Ambiguous symbol:'%s'", symbol->name);
+                err = -1;
+                break;
+            } else
+                g = symtab[g].addr;
+            y86bin.bytes = r->bytes;
+            memcpy(y86bin.codes, image + obj->base + r->addr, r->bytes);
+            fill_symbol(&y86bin, g);
+            if (image_put(obj->base + r->addr, y86bin.codes, r->bytes) < 0)
+                err = -1;
+        }
+    }
+    y86asm_fname = NULL;
+
+    if (!err) {
+        image_end = end;
+        err = binfile(out);
+    }
+    free(owner);
+    finit();
+    return err;
+}
+
+/* work shared by the assembler threads */
+typedef struct job {
+    char **files;
+    object_t **objs;
+    int nfiles;
+    int next;           /* next file for a thread to take */
+    pthread_mutex_t lock;
+} job_t;
+
+static void *assemble_thread(void *arg)
+{
+    job_t *job = (job_t *)arg;
+    char *name;
+    int i;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->nfiles)
+            break;
+        name = job->files[i];
+        if (!strcmp(name + strlen(name) - 2, ".o"))
+            job->objs[i] = read_object(name);
+        else
+            job->objs[i] = assemble_object(name);
+    }
+    return NULL;
+}
+
+/* 'fname' with its suffix (of 'len' chars) replaced by 'suffix' */
+static char *swap_suffix(char *fname, int len, char *suffix)
+{
+    int root = strlen(fname) - len;
+    char *s = (char *)malloc(root + strlen(suffix) + 1);
+    memcpy(s, fname, root);
+    strcpy(s + root, suffix);
+    return s;
+}
+
+/*
+ * assemble_files: assemble the .ys 'files' on 'threads' threads (0: one
+ *     per CPU), reading the .o ones, then either write each object next
+ *     to its source (outfname NULL) or link them all into 'outfname'
+ *
+ * return
+ *     0: success
+ *     -1: error
+ */
+int assemble_files(char **files, int nfiles, int threads, char *outfname)
+{
+    job_t job;
+    pthread_t *tid;
+    char *oname;
+    FILE *out;
+    int i, err = 0;
+
+    y86asm_lineno = -1;
+    job.files = files;
+    job.nfiles = nfiles;
+    job.next = 0;
+    job.objs = (object_t **)calloc(nfiles, sizeof(object_t *));
+    pthread_mutex_init(&job.lock, NULL);
+
+    if (!threads)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > nfiles)
+        threads = nfiles;
+    if (threads < 1)
+        threads = 1;
+    tid = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    for (i = 0; i < threads; i++)
+        pthread_create(&tid[i], NULL, assemble_thread, &job);
+    for (i = 0; i < threads; i++)
+        pthread_join(tid[i], NULL);
+
+    for (i = 0; i < nfiles; i++)
+        if (!job.objs[i])
+            err = -1;
+
+    if (!err && !outfname) {
+        /* -c: file.ys -> file.o */
+        for (i = 0; !err && i < nfiles; i++) {
+            if (!strcmp(files[i] + strlen(files[i]) - 2, ".o"))
+                continue;
+            oname = swap_suffix(files[i], 3, ".o");
+            out = fopen(oname, "wb");
+            if (!out || write_object(job.objs[i], out) < 0) {
+                err_print("Can't write object file '%s'", oname);
+                err = -1;
+            }
+            if (out)
+                fclose(out);
+            free(oname);
+        }
+    } else if (!err) {
+        out = fopen(outfname, "wb");
+        if (!out) {
+            err_print("Can't open output file '%s'", outfname);
+            err = -1;
+        } else {
+            if (link_objects(job.objs, nfiles, out) < 0) {
+                err_print("Link y86 objects error");
+                err = -1;
+            }
+            fclose(out);
+            if (err)
+                remove(outfname);
+        }
+    }
+
+    for (i = 0; i < nfiles; i++)
+        if (job.objs[i])
+            free_object(job.objs[i]);
+    free(job.objs);
+    free(tid);
+    pthread_mutex_destroy(&job.lock);
+    return err;
+}
+
+/*
+ * assemble_buffer: assemble the 'len' chars of y86 code at 'src', for a
+ *     driver that has the source in memory instead of a .ys file
+ * args
+ *     bin: where the binary code is written
+ *     listing: where the readable output is written, NULL for none
+ *
+ * return
+ *     0: success
+ *     -1: error, printed to y86asm_err the way y86asm prints it
+ */
+int assemble_buffer(char *src, long len, FILE *bin, FILE *listing)
+{
+    int err = -1;
+
+    init();
+    y86asm_text = (char *)malloc(len + 1); // freed in finit
+    memcpy(y86asm_text, src, len);
+    y86asm_text[len] = '\0';
+
+    if (assemble_text(len) < 0) {
+        err_print("Assemble y86 code error");
+    } else if (relocate() < 0) {
+        err_print("Relocate binary code error");
+    } else if (binfile(bin) < 0) {
+        err_print("Generate binary file error");
+    } else {
+        if (listing)
+            print_screen(listing);
+        err = 0;
+    }
+    finit();
+    return err;
+}
+
+/*
+ * Assembly cache: a directory with an entry per source assembled, named
+ * by a hash of the assembler version, its encoding tables and the
+ * source; the entry holds the
+ * source itself (so a hash collision is a miss), the binary code and the
+ * listing
+ */
+#define CACHE_MAGIC "Y86C"
+/* bump when the encoding changes in a way the tables below don't show */
+#define Y86ASM_VERSION "y86asm 1"
+
+typedef struct cache_hdr {
+    char magic[4];
+    char version[60];
+    int src_len;
+    int bin_len;
+    int listing_len;
+} cache_hdr_t;
+
+/* FNV-1a, 64 bits: entries are never checked by name alone */
+static unsigned long long hash_bytes(unsigned long long h, char *s, long len)
+{
+    long i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* fold the instruction set and the registers into the hash h */
+static unsigned long long hash_tables(unsigned long long h)
+{
+    char buf[32];
+    int i, n;
+
+    for (i = 0; instr_set[i].name; i++) {
+        n = sprintf(buf, "%s %x %d;", instr_set[i].name,
+                    instr_set[i].code, instr_set[i].bytes);
+        h = hash_bytes(h, buf, n);
+    }
+    for (i = 0; i < REG_CNT; i++) {
+        n = sprintf(buf, "%s %x;", reg_table[i].name, reg_table[i].id);
+        h = hash_bytes(h, buf, n);
+    }
+    return h;
+}
+
+/* read all of file 'name' into *buf (malloc'ed), -1 if it can't be read */
+static long read_file(char *name, char **buf)
+{
+    FILE *f = fopen(name, "rb");
+    long len;
+
+    if (!f)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    rewind(f);
+    *buf = (char *)malloc(len + 1);
+    if (len < 0 || fread(*buf, 1, len, f) != (size_t)len) {
+        free(*buf);
+        len = -1;
+    }
+    fclose(f);
+    return len;
+}
+
+/* the entry of the 'len' chars at 'src' in 'dir', with its header in *hdr */
+static char *cache_path(char *dir, char *src, long len, cache_hdr_t *hdr)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    char *path = (char *)malloc(strlen(dir) + 32);
+
+    memset(hdr, 0, sizeof(cache_hdr_t));
+    memcpy(hdr->magic, CACHE_MAGIC, 4);
+    strncpy(hdr->version, Y86ASM_VERSION, sizeof(hdr->version) - 1);
+    hdr->src_len = len;
+
+    h = hash_bytes(h, hdr->version, sizeof(hdr->version));
+    h = hash_tables(h);
+    h = hash_bytes(h, src, len);
+    sprintf(path, "%s/%016llx.yc", dir, h);
+    return path;
+}
+
+/*
+ * cache_load: look the source of 'hdr' up in the entry at 'path'
+ *
+ * return
+ *     the whole entry (header, source, binary code, listing) on a hit,
+ *     NULL on a miss
+ */
+static char *cache_load(char *path, cache_hdr_t *hdr, char *src)
+{
+    cache_hdr_t *e;
+    char *entry;
+    long n = read_file(path, &entry);
+
+    if (n < 0)
+        return NULL;
+    e = (cache_hdr_t *)entry;
+    if ((size_t)n < sizeof(cache_hdr_t) ||
+        memcmp(e, hdr, offsetof(cache_hdr_t, bin_len)) ||
+        e->bin_len < 0 || e->listing_len < 0 ||
+        (size_t)n != sizeof(cache_hdr_t) + (size_t)e->src_len +
+                     e->bin_len + e->listing_len ||
+        memcmp(entry + sizeof(cache_hdr_t), src, e->src_len)) {
+        free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+/* save an entry, best effort: written aside then renamed, so that a
+ * concurrent reader sees either no entry or a whole one */
+static void cache_store(char *dir, char *path, cache_hdr_t *hdr, char *src,
+                        char *bin, char *listing)
+{
+    char *tmp = (char *)malloc(strlen(path) + 8);
+    FILE *f;
+    int fd;
+    bool_t ok;
+
+    mkdir(dir, 0777);
+    sprintf(tmp, "%s.XXXXXX", path);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(tmp);
+        return;
+    }
+    f = fdopen(fd, "wb");
+    ok = f && fwrite(hdr, sizeof(cache_hdr_t), 1, f) == 1 &&
+         fwrite(src, 1, hdr->src_len, f) == (size_t)hdr->src_len &&
+         fwrite(bin, 1, hdr->bin_len, f) == (size_t)hdr->bin_len &&
+         fwrite(listing, 1, hdr->listing_len, f) == (size_t)hdr->listing_len;
+    if (f ? fclose(f) : close(fd))
+        ok = FALSE;
+    if (!ok || rename(tmp, path))
+        remove(tmp);
+    free(tmp);
+}
+
+/*
+ * assemble_cached: assemble_buffer() through the cache in 'cachedir' (no
+ *     cache if NULL): a source this build of y86asm assembled before is
+ *     not parsed again, its binary code and listing come from the cache
+ *
+ * return
+ *     0: success
+ *     -1: error (failed assemblies are not cached)
+ */
+int assemble_cached(char *src, long len, FILE *bin, FILE *listing,
+                    char *cachedir)
+{
+    cache_hdr_t hdr;
+    char *path, *entry, *code, *text = NULL;
+    size_t code_len = 0, text_len = 0;
+    FILE *code_out, *text_out;
+    int err;
+
+    if (!cachedir)
+        return assemble_buffer(src, len, bin, listing);
+
+    path = cache_path(cachedir, src, len, &hdr);
+    entry = cache_load(path, &hdr, src);
+    if (entry) {
+        memcpy(&hdr, entry, sizeof(cache_hdr_t));
+        code = entry + sizeof(cache_hdr_t) + hdr.src_len;
+        code_len = hdr.bin_len;
+        text = code + code_len;
+        text_len = hdr.listing_len;
+        err = 0;
+    } else {
+        /* the listing is kept even if not asked for, for a later -v */
+        code = NULL;
+        code_out = open_memstream(&code, &code_len);
+        text_out = open_memstream(&text, &text_len);
+        err = assemble_buffer(src, len, code_out, text_out);
+        fclose(code_out);
+        fclose(text_out);
+        if (!err) {
+            hdr.bin_len = code_len;
+            hdr.listing_len = text_len;
+            cache_store(cachedir, path, &hdr, src, code, text);
+        }
+    }
+
+    if (!err && (fwrite(code, 1, code_len, bin) != code_len ||
+                 (listing && fwrite(text, 1, text_len, listing) != text_len))) {
+        y86asm_lineno = -1;
+        err_print("Generate binary file error");
+        err = -1;
+    }
+    if (entry)
+        free(entry);
+    else {
+        free(code);
+        free(text);
+    }
+    free(path);
+    return err;
+}
+
+#ifndef Y86ASM_LIB
+/*
+ * assemble_file_cached: assemble 'infname' to 'outfname' through the cache
+ *     in 'cachedir', printing the listing if screen is set
+ *
+ * return
+ *     0: success
+ *     -1: error
+ */
+static int assemble_file_cached(char *infname, char *outfname, char *cachedir)
+{
+    char *src, *code = NULL, *text = NULL;
+    size_t code_len = 0, text_len = 0;
+    FILE *code_out, *text_out, *out;
+    long len;
+    int err;
+
+    y86asm_lineno = -1;
+    len = read_file(infname, &src);
+    if (len < 0) {
+        err_print("Can't open input file '%s'", infname);
+        return -1;
+    }
+    code_out = open_memstream(&code, &code_len);
+    text_out = open_memstream(&text, &text_len);
+    err = assemble_cached(src, len, code_out, screen ? text_out : NULL,
+                          cachedir);
+    fclose(code_out);
+    fclose(text_out);
+
+    if (!err) {
+        out = fopen(outfname, "wb");
+        if (!out) {
+            err_print("Can't open output file '%s'", outfname);
+            err = -1;
+        } else {
+            if (fwrite(code, 1, code_len, out) != code_len) {
+                err_print("Generate binary file error");
+                err = -1;
+            }
+            fclose(out);
+        }
+    }
+    if (!err && screen)
+        fwrite(text, 1, text_len, stdout);
+    free(src);
+    free(code);
+    free(text);
+    return err;
 }
 
 static void usage(char *pname)
 {
-    printf("Usage: %s [-v] file.ys\n", pname);
+    printf("Usage: %s [-v] [-C cachedir] file.ys\n", pname);
+    printf("   Or: %s [-j threads] -c file.ys...\n", pname);
+    printf("   Or: %s [-j threads] -o file.bin file.ys|file.o...\n", pname);
     printf("   -v print the readable output to screen\n");
+    printf("   -C directory of the assembly cache (default: $Y86ASM_CACHE,"
+           " none if unset)\n");
+    printf("   -c assemble each file.ys to a relocatable file.o\n");
+    printf("   -o assemble the .ys files and link them with the .o files"
+           " into file.bin\n");
+    printf("   -j threads to assemble with (default: one per CPU)\n");
     exit(0);
 }
 
@@ -1072,20 +2212,57 @@ int main(int argc, char *argv[])
     char outfname[512];
     int nextarg = 1;
     FILE *in = NULL, *out = NULL;
+    bool_t objects = FALSE;
+    char *linkfname = NULL;
+    int threads = 0, i, len;
+    char *cachedir = getenv("Y86ASM_CACHE");
     
     if (argc < 2)
         usage(argv[0]);
     
-    if (argv[nextarg][0] == '-') {
+    while (nextarg < argc && argv[nextarg][0] == '-') {
         char flag = argv[nextarg][1];
         switch (flag) {
           case 'v':
             screen = TRUE;
-            nextarg++;
+            break;
+          case 'c':
+            objects = TRUE;
+            break;
+          case 'o':
+            if (++nextarg == argc)
+                usage(argv[0]);
+            linkfname = argv[nextarg];
+            break;
+          case 'C':
+            if (++nextarg == argc)
+                usage(argv[0]);
+            cachedir = argv[nextarg];
+            break;
+          case 'j':
+            if (++nextarg == argc || (threads = atoi(argv[nextarg])) < 0)
+                usage(argv[0]);
             break;
           default:
             usage(argv[0]);
         }
+        nextarg++;
+    }
+    if (nextarg == argc)
+        usage(argv[0]);
+
+    if (objects || linkfname) {
+        /* several files: no listing, and only .ys (and .o to link) */
+        if (screen || (objects && linkfname))
+            usage(argv[0]);
+        for (i = nextarg; i < argc; i++) {
+            len = strlen(argv[i]);
+            if (!(len > 3 && !strcmp(argv[i]+len-3, ".ys")) &&
+                !(linkfname && len > 2 && !strcmp(argv[i]+len-2, ".o")))
+                usage(argv[0]);
+        }
+        return assemble_files(argv+nextarg, argc-nextarg, threads,
+                              linkfname) < 0;
     }
 
     /* parse input file name */
@@ -1100,20 +2277,29 @@ int main(int argc, char *argv[])
     }
 
 
+    memcpy(infname, argv[nextarg], rootlen);
+    strcpy(infname+rootlen, ".ys");
+    memcpy(outfname, argv[nextarg], rootlen);
+    strcpy(outfname+rootlen, ".bin");
+
+    /* unchanged sources are not assembled again */
+    if (cachedir)
+        return assemble_file_cached(infname, outfname, cachedir) < 0;
+
     /* init */
     init();
 
     
     /* assemble .ys file */
-    strncpy(infname, argv[nextarg], rootlen);
-    strcpy(infname+rootlen, ".ys");
     in = fopen(infname, "r");
     if (!in) {
         err_print("Can't open input file '%s'", infname);
         exit(1);
     }
     
-    if (assemble(in) < 0) {
+    /* without a listing to print, no line needs to be kept */
+    streaming = !screen;
+    if ((streaming ? assemble_stream(in) : assemble(in)) < 0) {
         err_print("Assemble y86 code error");
         fclose(in);
         exit(1);
@@ -1128,8 +2314,6 @@ int main(int argc, char *argv[])
     }
 
     /* generate .bin file */
-    strncpy(outfname, argv[nextarg], rootlen);
-    strcpy(outfname+rootlen, ".bin");
     out = fopen(outfname, "wb");
     if (!out) {
         err_print("Can't open output file '%s'", outfname);
@@ -1145,11 +2329,10 @@ int main(int argc, char *argv[])
     
     /* print to screen (.yo file) */
     if (screen)
-       print_screen(); 
+       print_screen(stdout); 
 
     /* finit */
     finit();
     return 0;
 }
-
-
+#endif
@@ -72,19 +72,65 @@ typedef struct line {
     struct line *next;
 } line_t;
 
+/* chunk of the arena that holds everything allocated for one assembly */
+typedef struct chunk {
+    struct chunk *next;
+    size_t size;    /* bytes of data after the header */
+    size_t used;
+} chunk_t;
+
+typedef struct arena {
+    chunk_t *head;  /* the chunk being filled, then older ones */
+} arena_t;
+
+#define ARENA_CHUNK (64*1024)
+
 /* label defined in y86 assembly code, e.g. Loop */
 typedef struct symbol {
-    char *name;
+    char *name;     /* interned: the only copy of the name */
     int addr;
-    struct symbol *next;
+    bool_t defined; /* FALSE while the symbol has only been referenced */
+    int patches;    /* streaming: first pending patch, -1 if none */
 } symbol_t;
 
 /* binary code need to be relocated */
 typedef struct reloc {
     bin_t *y86bin;
-    char *name;
+    int sym;        /* index of the symbol in symtab */
     struct reloc *next;
 } reloc_t;
 
+/* streaming: a reference to a symbol that was not defined yet, patched in
+ * the image once it is */
+typedef struct patch {
+    int addr;       /* address of the referencing instruction or data */
+    int bytes;      /* its size, which tells where the address field is */
+    int sym;
+    int next;       /* next pending patch of the same symbol, -1 at end */
+} patch_t;
+
+/* relocatable object: one file assembled at address 0, with its symbols
+ * and every reference to them, placed at 'base' by the linker */
+typedef struct object {
+    char *name;         /* the file it came from */
+    byte_t *image;      /* bytes up to the end of the last line */
+    int image_len;
+    int size;           /* address space used, from 0 */
+    symbol_t *symtab;   /* symbols, defined here or not */
+    int symtab_cnt;
+    patch_t *relocs;    /* every reference, in order */
+    int reloc_cnt;
+    int base;
+} object_t;
+
+#define OBJ_MAGIC "Y86O"
+#define OBJ_ALIGN 16    /* objects are linked at multiples of this */
+
+/* library use: compile y86asm.c with -DY86ASM_LIB to leave main() out */
+extern __thread FILE *y86asm_err;   /* where errors go, stderr if NULL */
+int assemble_buffer(char *src, long len, FILE *bin, FILE *listing);
+int assemble_cached(char *src, long len, FILE *bin, FILE *listing,
+                    char *cachedir);
+
 #endif
 
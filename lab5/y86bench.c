@@ -0,0 +1,101 @@
+/* Micro-benchmark: assemble a synthetic y86 program in memory, report lines/s */
+
+#include <time.h>
+
+#include "y86asm.h"
+
+#define BLOCK_LINES 12      /* lines of each block of the program */
+#define REPEAT 3            /* the best of this many runs is reported */
+
+/*
+ * gen_source: a program of about 'lines' lines, made of blocks that use
+ *     every kind of operand, with references back and forward
+ *
+ * return
+ *     the source (malloc'ed), its length in *len
+ */
+static char *gen_source(long lines, size_t *len)
+{
+    char *src = NULL;
+    FILE *f = open_memstream(&src, len);
+    long i, blocks = lines / BLOCK_LINES;
+
+    fprintf(f, "# synthetic program: %ld blocks\n", blocks);
+    fprintf(f, "        irmovl Stack, %%esp\n");
+    for (i = 0; i < blocks; i++) {
+        fprintf(f, "L%ld:    irmovl $%ld, %%eax      # block %ld\n", i, i * 7, i);
+        fprintf(f, "        rrmovl %%eax, %%ecx\n");
+        fprintf(f, "        addl %%ecx, %%edx\n");
+        fprintf(f, "        mrmovl 8(%%esp), %%ebx\n");
+        fprintf(f, "        rmmovl %%ebx, -0x%lx(%%ebp)\n", (i & 0xff) * 4);
+        fprintf(f, "        cmovle %%esi, %%edi\n");
+        fprintf(f, "\n");
+        fprintf(f, "        pushl %%esi\n");
+        fprintf(f, "        popl %%edi\n");
+        fprintf(f, "        jne L%ld\n", i + 1);
+        fprintf(f, "        call L%ld\n", i / 2);
+        fprintf(f, "        .long L%ld\n", i);
+    }
+    fprintf(f, "L%ld:    halt\n", blocks);
+    fprintf(f, "        .pos 0x%lx\n", blocks * 40 + 0x100);
+    fprintf(f, "Stack:\n");
+    fclose(f);
+    return src;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    long lines = 1000000;
+    bool_t listing = FALSE;
+    char *src, *code, *text;
+    size_t len, code_len, text_len;
+    FILE *code_out, *text_out;
+    double start, t, best = 0;
+    int i, nextarg = 1;
+
+    if (nextarg < argc && !strcmp(argv[nextarg], "-v")) {
+        listing = TRUE;
+        nextarg++;
+    }
+    if (nextarg < argc)
+        lines = atol(argv[nextarg]);
+    if (lines < BLOCK_LINES || nextarg + 1 < argc) {
+        printf("Usage: %s [-v] [lines]\n", argv[0]);
+        printf("   -v also generate the listing\n");
+        printf("   lines: size of the program (default: 1000000)\n");
+        return 1;
+    }
+
+    src = gen_source(lines, &len);
+    lines = lines / BLOCK_LINES * BLOCK_LINES + 5;
+    for (i = 0; i < REPEAT; i++) {
+        code = text = NULL;
+        code_out = open_memstream(&code, &code_len);
+        text_out = listing ? open_memstream(&text, &text_len) : NULL;
+        start = now();
+        if (assemble_buffer(src, len, code_out, text_out) < 0)
+            return 1;
+        fflush(code_out);
+        t = now() - start;
+        if (!i || t < best)
+            best = t;
+        fclose(code_out);
+        if (text_out)
+            fclose(text_out);
+        free(code);
+        free(text);
+    }
+
+    printf("%ld lines (%lu bytes)%s: %.3f s, %.0f lines/s\n", lines,
+           (unsigned long)len, listing ? " with listing" : "", best,
+           lines / best);
+    free(src);
+    return 0;
+}
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "y86asm.h"
+
 static int make_y86asm()
 {   
     return system("make > /dev/null");
@@ -15,11 +17,65 @@ static int make_y86asm()
 #define COMMAND_BUFFER_SIZE 1024
 static char cmdbuf[COMMAND_BUFFER_SIZE];
 
+// Assemble <dir>/<name>.ys the way "y86asm [-v]" does, but in this process
+// (y86asm.c is linked in): <name>.bin on success, <name>.yo if 'listing',
+// errors to 'errname' (NULL: stderr). Sources unchanged since the last run
+// are taken from the assembly cache in $Y86ASM_CACHE, if set.
+static int asm_stu(const char *dir, const char *name, int listing,
+                   const char *errname)
+{
+    char path[COMMAND_BUFFER_SIZE];
+    char *src, *code = NULL;
+    size_t code_len = 0;
+    long len;
+    FILE *in, *bin, *yo = NULL;
+    int ret = 1;
+
+    sprintf(path, "%s/%s.ys", dir, name);
+    in = fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "yat: Cannot read %s\n", path);
+        return 1;
+    }
+    fseek(in, 0, SEEK_END);
+    len = ftell(in);
+    rewind(in);
+    src = malloc(len + 1);
+    if (fread(src, 1, len, in) != (size_t)len)
+        len = -1;
+    fclose(in);
+
+    if (listing) {
+        sprintf(path, "%s/%s.yo", dir, name);
+        yo = fopen(path, "w");
+    }
+    y86asm_err = errname ? fopen(errname, "w") : NULL;
+    bin = open_memstream(&code, &code_len);
+    if (len >= 0 && (!listing || yo) && (!errname || y86asm_err))
+        ret = assemble_cached(src, len, bin, yo, getenv("Y86ASM_CACHE")) < 0;
+    fclose(bin);
+    if (!ret) {
+        sprintf(path, "%s/%s.bin", dir, name);
+        bin = fopen(path, "wb");
+        if (!bin || fwrite(code, 1, code_len, bin) != code_len)
+            ret = 1;
+        if (bin)
+            fclose(bin);
+    }
+
+    if (yo)
+        fclose(yo);
+    if (y86asm_err)
+        fclose(y86asm_err);
+    y86asm_err = NULL;
+    free(code);
+    free(src);
+    return ret;
+}
+
 static int make_app_stu(const char *name)
 {
-    sprintf(cmdbuf, "cd y86-app; make %s.yo > /dev/null", name);
-    
-    return system(cmdbuf);
+    return asm_stu("y86-app", name, 1, NULL);
 }
 
 static int make_app_base(const char *name)
@@ -38,9 +94,9 @@ static int diff_app(const char *name)
 
 static int make_err_stu(const char *name)
 {
-    sprintf(cmdbuf, "./y86asm y86-err/%s.ys 2> %s.err", name, name);
+    sprintf(cmdbuf, "%s.err", name);
     
-    return !system(cmdbuf);
+    return !asm_stu("y86-err", name, 0, cmdbuf);
 }
 
 static int make_err_base(const char *name)
@@ -59,9 +115,7 @@ static int diff_err(const char *name)
 
 static int make_ins_stu(const char *name)
 {
-    sprintf(cmdbuf, "cd y86-ins; make %s.yo > /dev/null", name);
-   
-    return system(cmdbuf);
+    return asm_stu("y86-ins", name, 1, NULL);
 }
 
 static int make_ins_base(const char *name)
@@ -2,6 +2,11 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "isa.h"
 
 
@@ -190,30 +195,152 @@ int hex2dig(char c)
 	return c - 'a' + 10;
 }
 
+/* Value of each hex digit character, -1 for any other character */
+static signed char hex_value[256];
+static int hex_ready = 0;
+
+static void init_hex()
+{
+    int c;
+    for (c = 0; c < 256; c++)
+	hex_value[c] = isxdigit(c) ? hex2dig(c) : -1;
+    hex_ready = 1;
+}
+
+/*
+ * Decode the n pairs of hex digits at s into dest.  Eight digits are
+ * decoded at a time in a 64-bit word: a digit is 0x30-0x39, 0x41-0x46
+ * or 0x61-0x66, so its value is its low nibble, plus 9 when bit 6
+ * (letter) is set.  This is plain C rather than SIMD intrinsics: the
+ * Makefiles build with -Wall -O2 and no -m or target flags, for
+ * whatever host the lab runs on, so no vector extension is assumed
+ */
+static void decode_hex(char *s, byte_t *dest, int n)
+{
+    int i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 4 <= n; i += 4) {
+	uint64_t x, v;
+	memcpy(&x, s + 2*i, 8);
+	v = (x & 0x0F0F0F0F0F0F0F0FULL) +
+	    9 * ((x >> 6) & 0x0101010101010101ULL);
+	/* Each pair of digits into the low byte of its 16-bit lane */
+	v = ((v & 0x00FF00FF00FF00FFULL) << 4) |
+	    ((v >> 8) & 0x00FF00FF00FF00FFULL);
+	dest[i] = v;
+	dest[i+1] = v >> 16;
+	dest[i+2] = v >> 32;
+	dest[i+3] = v >> 48;
+    }
+#endif
+    for (; i < n; i++)
+	dest[i] = hex_value[(byte_t) s[2*i]] * 16 +
+	    hex_value[(byte_t) s[2*i+1]];
+}
+
+/* Load the binary object in the size bytes at img (see isa.h) */
+static int load_image(mem_t m, char *img, size_t size, int report_error)
+{
+    ybo_hdr_t hdr;
+    ybo_seg_t seg;
+    size_t pos, i;
+    char *code;
+
+    if (size < sizeof(hdr)) {
+	if (report_error)
+	    fprintf(stderr, "Error reading file. Truncated binary object\n");
+	return 0;
+    }
+    memcpy(&hdr, img, sizeof(hdr));
+    pos = sizeof(hdr) + (size_t) hdr.nseg * sizeof(ybo_seg_t);
+    if (memcmp(hdr.magic, YBO_MAGIC, sizeof(hdr.magic)) != 0 ||
+	hdr.nseg > size || pos + hdr.bytes > size) {
+	if (report_error)
+	    fprintf(stderr, "Error reading file. Not a valid binary object\n");
+	return 0;
+    }
+    code = img + pos;
+    for (i = 0; i < hdr.nseg; i++) {
+	memcpy(&seg, img + sizeof(hdr) + i * sizeof(seg), sizeof(seg));
+	if (seg.len > hdr.bytes - (code - img - pos) ||
+	    seg.addr > (unsigned) m->len || seg.len > m->len - seg.addr) {
+	    if (report_error)
+		fprintf(stderr,
+			"Error reading file. Invalid address. 0x%x\n",
+			seg.addr);
+	    return 0;
+	}
+	memcpy(m->contents + seg.addr, code, seg.len);
+	code += seg.len;
+    }
+    return hdr.bytes;
+}
+
+/* Load a binary object, whose first byte has already been read from
+   infile.  A regular file is mapped rather than read */
+static int load_bin(mem_t m, FILE *infile, int report_error)
+{
+    struct stat st;
+    char *img = NULL;
+    size_t size = 0, cap, n;
+    int byte_cnt;
+
+    if (fstat(fileno(infile), &st) == 0 && S_ISREG(st.st_mode) &&
+	st.st_size > 0) {
+	img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+		   fileno(infile), 0);
+	if (img != MAP_FAILED) {
+	    byte_cnt = load_image(m, img, st.st_size, report_error);
+	    munmap(img, st.st_size);
+	    return byte_cnt;
+	}
+    }
+    /* A pipe: read it all */
+    cap = 4096;
+    img = malloc(cap);
+    img[size++] = YBO_MAGIC[0];
+    while ((n = fread(img + size, 1, cap - size, infile)) > 0) {
+	size += n;
+	if (size == cap)
+	    img = realloc(img, cap *= 2);
+    }
+    byte_cnt = load_image(m, img, size, report_error);
+    free(img);
+    return byte_cnt;
+}
+
 #define LINELEN 4096
 int load_mem(mem_t m, FILE *infile, int report_error)
 {
     /* Read contents of .yo file */
     char buf[LINELEN];
-    char c, ch, cl;
+    char c;
     int byte_cnt = 0;
     int lineno = 0;
     word_t bytepos = 0;
-    int empty_line = 1;
-    int addr = 0;
-    char hexcode[15];
+    int ndigits, nbytes, first;
 
 #ifdef HAS_GUI
     /* For display */
     int line_no = 0;
     char line[LINELEN];
+    int addr = 0;
+    char hexcode[15];
+    int index = 0;
 #endif /* HAS_GUI */   
 
-    int index = 0;
+    if (!hex_ready)
+	init_hex();
+
+    /* Binary object? */
+    first = getc(infile);
+    if (first == YBO_MAGIC[0])
+	return load_bin(m, infile, report_error);
+    if (first != EOF)
+	ungetc(first, infile);
 
     while (fgets(buf, LINELEN, infile)) {
 	int cpos = 0;
-	empty_line = 1;
 	lineno++;
 	/* Skip white space */
 	while (isspace((int)buf[cpos]))
@@ -226,9 +353,9 @@ int load_mem(mem_t m, FILE *infile, int report_error)
 
 	/* Get address */
 	bytepos = 0;
-	while (isxdigit((int)(c=buf[cpos]))) {
+	while (hex_value[(byte_t) (c=buf[cpos])] >= 0) {
 	    cpos++;
-	    bytepos = bytepos*16 + hex2dig(c);
+	    bytepos = bytepos*16 + hex_value[(byte_t) c];
 	}
 
 	while (isspace((int)buf[cpos]))
@@ -244,37 +371,41 @@ int load_mem(mem_t m, FILE *infile, int report_error)
 	    return 0;
 	}
 
+#ifdef HAS_GUI
 	addr = bytepos;
+#endif
 
 	while (isspace((int)buf[cpos]))
 	    cpos++;
 
-	index = 0;
-
-	/* Get code */
-	while (isxdigit((int)(ch=buf[cpos++])) && 
-	       isxdigit((int)(cl=buf[cpos++]))) {
-	    byte_t byte = 0;
-	    if (bytepos >= m->len) {
-		if (report_error) {
-		    fprintf(stderr,
-			    "Error reading file. Invalid address. 0x%x\n",
-			    bytepos);
-		    fprintf(stderr, "Line %d:%s\n", lineno, buf);
-		}
-		return 0;
+	/* Get code: as many pairs of hex digits as there are */
+	for (ndigits = 0; hex_value[(byte_t) buf[cpos+ndigits]] >= 0; ndigits++)
+	    ;
+	nbytes = ndigits / 2;
+	if (bytepos + nbytes > m->len) {
+	    if (bytepos < m->len)
+		decode_hex(buf + cpos, m->contents + bytepos,
+			   m->len - bytepos);
+	    if (report_error) {
+		fprintf(stderr,
+			"Error reading file. Invalid address. 0x%x\n",
+			bytepos < m->len ? m->len : bytepos);
+		fprintf(stderr, "Line %d:%s\n", lineno, buf);
 	    }
-	    byte = hex2dig(ch)*16+hex2dig(cl);
-	    m->contents[bytepos++] = byte;
-	    byte_cnt++;
-	    empty_line = 0;
-	    hexcode[index++] = ch;
-	    hexcode[index++] = cl;
-	}
-	/* Fill rest of hexcode with blanks */
+	    return 0;
+	}
+	decode_hex(buf + cpos, m->contents + bytepos, nbytes);
+	byte_cnt += nbytes;
+
+#ifdef HAS_GUI
+	/* Code as text, filled with blanks */
+	for (index = 0; index < 2*nbytes && index < 12; index++)
+	    hexcode[index] = buf[cpos+index];
 	for (; index < 12; index++)
 	    hexcode[index] = ' ';
 	hexcode[index] = '\0';
+#endif /* HAS_GUI */
+	cpos += 2*nbytes;
 
 #ifdef HAS_GUI
 	if (gui_mode) {
@@ -288,7 +419,7 @@ int load_mem(mem_t m, FILE *infile, int report_error)
 		line[index++] = c;
 	    }
 	    line[index] = '\0';
-	    if (!empty_line)
+	    if (nbytes > 0)
 		report_line(line_no++, addr, hexcode, line);
 	}
 #endif /* HAS_GUI */ 
@@ -949,3 +1080,533 @@ stat_t step_state(state_ptr s, FILE *error_file)
     }
     return STAT_AOK;
 }
+
+/*
+ * Fast execution for yis.  Each instruction is decoded once, the first
+ * time it executes, into a table indexed by its address, and common
+ * sequences are fused into superinstructions that run as one.  Anything
+ * unusual, including every fault, goes through step_state, so the
+ * results and error messages are those of step_state.
+ */
+
+/* Operations of decoded instructions */
+typedef enum { X_NONE, X_SLOW, X_NOP, X_RRMOVL, X_IRMOVL, X_RMMOVL, X_MRMOVL,
+	       X_ALU, X_JXX, X_CALL, X_RET, X_PUSHL, X_POPL, X_LEAVE,
+	       X_IADDL } xop_t;
+
+/* Superinstructions */
+typedef enum { SI_NONE, SI_MRMOVL_ALU_JXX, SI_ALU_JXX, SI_IADDL_JXX,
+	       SI_PUSHL_POPL } fop_t;
+
+/* Longest byte span of a superinstruction (mrmovl, OPl, jXX) */
+#define FUSE_SPAN 13
+
+typedef struct {
+    byte_t op;		/* xop_t, X_NONE until decoded */
+    byte_t fused;	/* fop_t of the sequence starting here */
+    byte_t fun;
+    byte_t ra, rb;	/* REG_NONE if absent or not a register */
+    word_t valc;
+    word_t next;	/* Fall-through PC */
+} dinstr_t;
+
+typedef struct {
+    word_t r[16];	/* Registers, r[8..15] read as 0 */
+    cc_t cc;
+    word_t pc;
+    mem_t m;
+    dinstr_t *dtab;	/* One entry per byte of memory */
+    word_t code_lo, code_hi;	/* Range of decoded addresses */
+} fast_t;
+
+static int fuse_len[] = { 1, 3, 2, 2, 2 };
+
+static void fast_decode(fast_t *f, word_t pc);
+
+/* Decoded entry for pc, or NULL if pc is not in memory */
+static dinstr_t *fast_entry(fast_t *f, word_t pc)
+{
+    if (pc < 0 || pc >= f->m->len)
+	return NULL;
+    if (f->dtab[pc].op == X_NONE)
+	fast_decode(f, pc);
+    return &f->dtab[pc];
+}
+
+static void fast_decode(fast_t *f, word_t pc)
+{
+    dinstr_t *d = &f->dtab[pc], *d2, *d3;
+    mem_t m = f->m;
+    byte_t byte0 = 0, byte1 = 0;
+    itype_t hi0;
+    reg_id_t hi1, lo1;
+    word_t next = pc + 1;
+
+    d->op = X_SLOW;
+    d->fused = SI_NONE;
+    d->ra = d->rb = REG_NONE;
+    d->valc = 0;
+    if (pc < f->code_lo)
+	f->code_lo = pc;
+    if (pc > f->code_hi)
+	f->code_hi = pc;
+
+    get_byte_val(m, pc, &byte0);
+    hi0 = HI4(byte0);
+    d->fun = LO4(byte0);
+    if (hi0 == I_RRMOVL || hi0 == I_ALU || hi0 == I_PUSHL ||
+	hi0 == I_POPL || hi0 == I_IRMOVL || hi0 == I_RMMOVL ||
+	hi0 == I_MRMOVL || hi0 == I_IADDL) {
+	if (!get_byte_val(m, next, &byte1))
+	    return;
+	next++;
+    }
+    hi1 = HI4(byte1);
+    lo1 = LO4(byte1);
+    if (hi0 == I_IRMOVL || hi0 == I_RMMOVL || hi0 == I_MRMOVL ||
+	hi0 == I_JMP || hi0 == I_CALL || hi0 == I_IADDL) {
+	if (!get_word_val(m, next, &d->valc))
+	    return;
+	next += 4;
+    }
+    d->next = next;
+
+    /* Leave to step_state what it would reject or treat specially */
+    switch (hi0) {
+    case I_NOP:
+	d->op = X_NOP;
+	break;
+    case I_RRMOVL:
+	if (reg_valid(hi1) && reg_valid(lo1) && d->fun <= C_G) {
+	    d->op = X_RRMOVL;
+	    d->ra = hi1;
+	    d->rb = lo1;
+	}
+	break;
+    case I_IRMOVL:
+    case I_IADDL:
+	if (reg_valid(lo1)) {
+	    d->op = hi0 == I_IRMOVL ? X_IRMOVL : X_IADDL;
+	    d->rb = lo1;
+	}
+	break;
+    case I_RMMOVL:
+    case I_MRMOVL:
+	if (reg_valid(hi1)) {
+	    d->op = hi0 == I_RMMOVL ? X_RMMOVL : X_MRMOVL;
+	    d->ra = hi1;
+	    d->rb = reg_valid(lo1) ? lo1 : REG_NONE;
+	}
+	break;
+    case I_ALU:
+	if (reg_valid(hi1) && reg_valid(lo1) && d->fun <= A_XOR) {
+	    d->op = X_ALU;
+	    d->ra = hi1;
+	    d->rb = lo1;
+	}
+	break;
+    case I_JMP:
+	if (d->fun <= C_G)
+	    d->op = X_JXX;
+	break;
+    case I_CALL:
+	d->op = X_CALL;
+	break;
+    case I_RET:
+	d->op = X_RET;
+	break;
+    case I_PUSHL:
+    case I_POPL:
+	if (reg_valid(hi1)) {
+	    d->op = hi0 == I_PUSHL ? X_PUSHL : X_POPL;
+	    d->ra = hi1;
+	}
+	break;
+    case I_LEAVE:
+	d->op = X_LEAVE;
+	break;
+    default:
+	break;
+    }
+
+    /* Superinstructions */
+    switch (d->op) {
+    case X_MRMOVL:
+	if ((d2 = fast_entry(f, next)) && d2->op == X_ALU &&
+	    (d3 = fast_entry(f, d2->next)) && d3->op == X_JXX)
+	    d->fused = SI_MRMOVL_ALU_JXX;
+	break;
+    case X_ALU:
+    case X_IADDL:
+	if ((d2 = fast_entry(f, next)) && d2->op == X_JXX)
+	    d->fused = d->op == X_ALU ? SI_ALU_JXX : SI_IADDL_JXX;
+	break;
+    case X_PUSHL:
+	if ((d2 = fast_entry(f, next)) && d2->op == X_POPL)
+	    d->fused = SI_PUSHL_POPL;
+	break;
+    default:
+	break;
+    }
+}
+
+/* Is the word at addr in memory? (as get_word_val and set_word_val) */
+#define FAST_WORD_OK(f, addr) ((addr) >= 0 && (addr) + 4 <= (f)->m->len)
+
+static word_t fast_read(fast_t *f, word_t addr)
+{
+    byte_t *p = f->m->contents + addr;
+    return p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24;
+}
+
+/* Write a word, dropping the decoding of any instruction it overlaps */
+static void fast_write(fast_t *f, word_t addr, word_t val)
+{
+    byte_t *p = f->m->contents + addr;
+    word_t a, hi;
+
+    p[0] = val;
+    p[1] = val >> 8;
+    p[2] = val >> 16;
+    p[3] = val >> 24;
+    if (addr + 3 < f->code_lo || addr - (FUSE_SPAN - 1) > f->code_hi)
+	return;
+    a = addr - (FUSE_SPAN - 1) < 0 ? 0 : addr - (FUSE_SPAN - 1);
+    hi = addr + 3 < f->m->len ? addr + 3 : f->m->len - 1;
+    for (; a <= hi; a++)
+	f->dtab[a].op = X_NONE;
+}
+
+/* Execute one decoded instruction.  Return FALSE, with nothing changed,
+   if it has to go through step_state */
+static bool_t fast_step(fast_t *f, dinstr_t *d)
+{
+    word_t *r = f->r;
+    word_t a, b;
+
+    switch (d->op) {
+    case X_NOP:
+	break;
+    case X_RRMOVL:
+	if (cond_holds(f->cc, d->fun))
+	    r[d->rb] = r[d->ra];
+	break;
+    case X_IRMOVL:
+	r[d->rb] = d->valc;
+	break;
+    case X_RMMOVL:
+	a = d->valc + r[d->rb];
+	if (!FAST_WORD_OK(f, a))
+	    return FALSE;
+	fast_write(f, a, r[d->ra]);
+	break;
+    case X_MRMOVL:
+	a = d->valc + r[d->rb];
+	if (!FAST_WORD_OK(f, a))
+	    return FALSE;
+	r[d->ra] = fast_read(f, a);
+	break;
+    case X_ALU:
+	a = r[d->ra];
+	b = r[d->rb];
+	r[d->rb] = compute_alu(d->fun, a, b);
+	f->cc = compute_cc(d->fun, a, b);
+	break;
+    case X_JXX:
+	f->pc = cond_holds(f->cc, d->fun) ? d->valc : d->next;
+	return TRUE;
+    case X_CALL:
+	a = r[REG_ESP] - 4;
+	if (!FAST_WORD_OK(f, a))
+	    return FALSE;
+	r[REG_ESP] = a;
+	fast_write(f, a, d->next);
+	f->pc = d->valc;
+	return TRUE;
+    case X_RET:
+	a = r[REG_ESP];
+	if (!FAST_WORD_OK(f, a))
+	    return FALSE;
+	r[REG_ESP] = a + 4;
+	f->pc = fast_read(f, a);
+	return TRUE;
+    case X_PUSHL:
+	a = r[REG_ESP] - 4;
+	if (!FAST_WORD_OK(f, a))
+	    return FALSE;
+	b = r[d->ra];
+	r[REG_ESP] = a;
+	fast_write(f, a, b);
+	break;
+    case X_POPL:
+	a = r[REG_ESP];
+	if (!FAST_WORD_OK(f, a))
+	    return FALSE;
+	r[REG_ESP] = a + 4;
+	r[d->ra] = fast_read(f, a);
+	break;
+    case X_LEAVE:
+	a = r[REG_EBP];
+	if (!FAST_WORD_OK(f, a))
+	    return FALSE;
+	r[REG_ESP] = a + 4;
+	r[REG_EBP] = fast_read(f, a);
+	break;
+    case X_IADDL:
+	b = r[d->rb];
+	r[d->rb] = b + d->valc;
+	f->cc = compute_cc(A_ADD, d->valc, b);
+	break;
+    default:
+	return FALSE;
+    }
+    f->pc = d->next;
+    return TRUE;
+}
+
+/* Execute the superinstruction starting with d.  Return the number of
+   instructions it executed, 0 if the first one has to go through
+   step_state */
+static int fast_fused(fast_t *f, dinstr_t *d)
+{
+    word_t *r = f->r;
+    dinstr_t *d2 = &f->dtab[d->next], *d3;
+    word_t a, b, pc = f->pc;
+
+    switch (d->fused) {
+    case SI_MRMOVL_ALU_JXX:
+	/* E.g. mrmovl (%ebx), %esi; andl %esi, %esi; jle Done */
+	a = d->valc + r[d->rb];
+	if (!FAST_WORD_OK(f, a))
+	    return 0;
+	r[d->ra] = fast_read(f, a);
+	d3 = &f->dtab[d2->next];
+	a = r[d2->ra];
+	b = r[d2->rb];
+	r[d2->rb] = compute_alu(d2->fun, a, b);
+	f->cc = compute_cc(d2->fun, a, b);
+	f->pc = cond_holds(f->cc, d3->fun) ? d3->valc : d3->next;
+	return 3;
+    case SI_ALU_JXX:
+	a = r[d->ra];
+	b = r[d->rb];
+	r[d->rb] = compute_alu(d->fun, a, b);
+	f->cc = compute_cc(d->fun, a, b);
+	f->pc = cond_holds(f->cc, d2->fun) ? d2->valc : d2->next;
+	return 2;
+    case SI_IADDL_JXX:
+	b = r[d->rb];
+	r[d->rb] = b + d->valc;
+	f->cc = compute_cc(A_ADD, d->valc, b);
+	f->pc = cond_holds(f->cc, d2->fun) ? d2->valc : d2->next;
+	return 2;
+    case SI_PUSHL_POPL:
+	/* The popl reads back the word the pushl writes */
+	a = r[REG_ESP] - 4;
+	if (!FAST_WORD_OK(f, a))
+	    return 0;
+	b = r[d->ra];
+	fast_write(f, a, b);
+	f->pc = d->next;
+	if (a + 4 > pc && a < d2->next) {
+	    /* The pushl overwrote itself or the popl */
+	    r[REG_ESP] = a;
+	    return 1;
+	}
+	r[REG_ESP] = a + 4;
+	r[d2->ra] = b;
+	f->pc = d2->next;
+	return 2;
+    default:
+	return 0;
+    }
+}
+
+stat_t run_state(state_ptr s, int max_steps, int *stepsp, FILE *error_file)
+{
+    fast_t f;
+    dinstr_t *d;
+    stat_t e = STAT_AOK;
+    int steps = 0, n;
+    reg_id_t id;
+
+    memset(&f, 0, sizeof(f));
+    f.m = s->m;
+    f.dtab = (dinstr_t *) calloc(f.m->len, sizeof(dinstr_t));
+    f.code_lo = f.m->len;
+    f.code_hi = -1;
+    for (id = 0; reg_valid(id); id++)
+	f.r[id] = get_reg_val(s->r, id);
+    f.cc = s->cc;
+    f.pc = s->pc;
+
+    while (steps < max_steps && e == STAT_AOK) {
+	d = fast_entry(&f, f.pc);
+	if (d) {
+	    if (d->fused && steps + fuse_len[d->fused] <= max_steps &&
+		(n = fast_fused(&f, d)) > 0) {
+		steps += n;
+		continue;
+	    }
+	    if (fast_step(&f, d)) {
+		steps++;
+		continue;
+	    }
+	}
+	/* Faults and odd encodings: none of them writes memory and
+	   succeeds, so the decoded instructions stay valid */
+	for (id = 0; reg_valid(id); id++)
+	    set_reg_val(s->r, id, f.r[id]);
+	s->cc = f.cc;
+	s->pc = f.pc;
+	e = step_state(s, error_file);
+	steps++;
+	for (id = 0; reg_valid(id); id++)
+	    f.r[id] = get_reg_val(s->r, id);
+	f.cc = s->cc;
+	f.pc = s->pc;
+    }
+
+    for (id = 0; reg_valid(id); id++)
+	set_reg_val(s->r, id, f.r[id]);
+    s->cc = f.cc;
+    s->pc = f.pc;
+    free(f.dtab);
+    *stepsp = steps;
+    return e;
+}
+
+/*
+ * Lockstep co-simulation: step the ISA one instruction each time the
+ * processor retires one, and compare what that instruction did.
+ */
+cosim_ptr new_cosim(mem_t m, mem_t r, cc_t cc, FILE *error_file)
+{
+    cosim_ptr c = (cosim_ptr) calloc(1, sizeof(cosim_rec));
+    c->isa = new_state(0);
+    free_mem(c->isa->r);
+    free_mem(c->isa->m);
+    c->isa->m = copy_mem(m);
+    c->isa->r = copy_mem(r);
+    c->isa->cc = cc;
+    c->error_file = error_file;
+    return c;
+}
+
+void free_cosim(cosim_ptr c)
+{
+    free_state(c->isa);
+    free(c);
+}
+
+void cosim_write(cosim_ptr c, word_t pc, word_t addr, word_t val)
+{
+    if (c->nwrites == COSIM_WRITES) {
+	if (!c->failed)
+	    sprintf(c->msg, "PC 0x%x: wrote 0x%x to 0x%x, %d writes pending",
+		    pc, val, addr, COSIM_WRITES);
+	c->failed = TRUE;
+	return;
+    }
+    c->wpc[c->nwrites] = pc;
+    c->waddr[c->nwrites] = addr;
+    c->wdata[c->nwrites] = val;
+    c->nwrites++;
+}
+
+bool_t cosim_retire(cosim_ptr c, word_t pc, stat_t stat, mem_t r,
+		    reg_id_t pending)
+{
+    state_ptr s = c->isa;
+    byte_t instr = HPACK(I_NOP, F_NONE);
+    byte_t regids = HPACK(REG_NONE, REG_NONE);
+    word_t valc = 0, addr = 0, val = 0;
+    bool_t writes = FALSE, wrote;
+    stat_t e;
+    reg_id_t id;
+    int i;
+
+    if (c->failed)
+	return FALSE;
+    if (pc != s->pc) {
+	sprintf(c->msg, "PC 0x%x retired, ISA expects PC 0x%x", pc, s->pc);
+	c->failed = TRUE;
+	return FALSE;
+    }
+
+    /* The word the ISA is about to write, if any */
+    get_byte_val(s->m, pc, &instr);
+    get_byte_val(s->m, pc+1, &regids);
+    switch (HI4(instr)) {
+    case I_RMMOVL:
+	get_word_val(s->m, pc+2, &valc);
+	addr = valc;
+	if (reg_valid(LO4(regids)))
+	    addr += get_reg_val(s->r, LO4(regids));
+	val = reg_valid(HI4(regids)) ? get_reg_val(s->r, HI4(regids)) : 0;
+	writes = TRUE;
+	break;
+    case I_PUSHL:
+	addr = get_reg_val(s->r, REG_ESP) - 4;
+	val = reg_valid(HI4(regids)) ? get_reg_val(s->r, HI4(regids)) : 0;
+	writes = TRUE;
+	break;
+    case I_CALL:
+	addr = get_reg_val(s->r, REG_ESP) - 4;
+	val = pc + 5;
+	writes = TRUE;
+	break;
+    }
+
+    e = step_state(s, c->error_file);
+    c->steps++;
+    if (e != stat) {
+	sprintf(c->msg, "PC 0x%x: status %s, ISA status %s", pc,
+		stat_name(stat), stat_name(e));
+	c->failed = TRUE;
+	return FALSE;
+    }
+    /* Past an exception, only the status is defined */
+    if (e != STAT_AOK)
+	return TRUE;
+
+    wrote = c->nwrites > 0 && c->wpc[0] == pc;
+    if (writes && !wrote) {
+	sprintf(c->msg, "PC 0x%x: no write, ISA writes 0x%x to 0x%x",
+		pc, val, addr);
+	c->failed = TRUE;
+	return FALSE;
+    }
+    if (wrote) {
+	if (!writes || c->waddr[0] != addr || c->wdata[0] != val) {
+	    if (writes)
+		sprintf(c->msg, "PC 0x%x: wrote 0x%x to 0x%x, ISA writes 0x%x to 0x%x",
+			pc, c->wdata[0], c->waddr[0], val, addr);
+	    else
+		sprintf(c->msg, "PC 0x%x: wrote 0x%x to 0x%x, ISA writes nothing",
+			pc, c->wdata[0], c->waddr[0]);
+	    c->failed = TRUE;
+	    return FALSE;
+	}
+	c->nwrites--;
+	for (i = 0; i < c->nwrites; i++) {
+	    c->wpc[i] = c->wpc[i+1];
+	    c->waddr[i] = c->waddr[i+1];
+	    c->wdata[i] = c->wdata[i+1];
+	}
+    }
+
+    /* Usually the register files are identical */
+    if (memcmp(r->contents, s->r->contents, r->len) == 0)
+	return TRUE;
+    for (id = 0; reg_valid(id); id++) {
+	if (id != pending && get_reg_val(r, id) != get_reg_val(s->r, id)) {
+	    sprintf(c->msg, "PC 0x%x: %s = 0x%x, ISA %s = 0x%x", pc,
+		    reg_name(id), get_reg_val(r, id), reg_name(id),
+		    get_reg_val(s->r, id));
+	    c->failed = TRUE;
+	    return FALSE;
+	}
+    }
+    return TRUE;
+}
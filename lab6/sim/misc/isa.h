@@ -108,9 +108,25 @@ bool_t diff_mem(mem_t oldm, mem_t newm, FILE *outfile);
 
 /*** In the following functions, a return value of 1 means success ***/
 
-/* Load memory from .yo file.  Return number of bytes read */
+/* Load memory from .yo file, or from a binary object made by yas -b.
+   Return number of bytes read */
 int load_mem(mem_t m, FILE *infile, int report_error);
 
+/* Binary object file (yas -b): a ybo_hdr_t, the table of its nseg
+   segments, then the bytes of all the segments, in the same order */
+#define YBO_MAGIC "Y86B"
+
+typedef struct {
+  char magic[4];
+  unsigned nseg;   /* Number of segments */
+  unsigned bytes;  /* Total bytes of code */
+} ybo_hdr_t;
+
+typedef struct {
+  unsigned addr;   /* Load address */
+  unsigned len;    /* Number of bytes */
+} ybo_seg_t;
+
 /* Get byte from memory */
 bool_t get_byte_val(mem_t m, word_t pos, byte_t *dest);
 
@@ -193,6 +209,43 @@ bool_t cond_holds(cc_t cc, cond_t bcond);
 /* Execute single instruction.  Return status. */
 stat_t step_state(state_ptr s, FILE *error_file);
 
+/* Execute up to max_steps instructions, with the same results as that
+   many calls of step_state but faster.  Set *stepsp to the number of
+   steps taken and return the status of the last one. */
+stat_t run_state(state_ptr s, int max_steps, int *stepsp, FILE *error_file);
+
+/* **************** Lockstep co-simulation (-t) *********/
+
+/* Processor memory writes not yet retired */
+#define COSIM_WRITES 8
+
+typedef struct {
+  state_ptr isa;	/* ISA state after the last retirement */
+  FILE *error_file;	/* Where the ISA reports a fault, or NULL */
+  int steps;		/* Instructions retired */
+  int nwrites;		/* Writes of instructions not yet retired */
+  word_t wpc[COSIM_WRITES];
+  word_t waddr[COSIM_WRITES];
+  word_t wdata[COSIM_WRITES];
+  bool_t failed;
+  char msg[128];	/* Description of the first divergence */
+} cosim_rec, *cosim_ptr;
+
+/* Check a processor starting from memory m, registers r and cc.  The
+   ISA describes any fault it takes on error_file, unless it is NULL */
+cosim_ptr new_cosim(mem_t m, mem_t r, cc_t cc, FILE *error_file);
+void free_cosim(cosim_ptr c);
+
+/* The processor wrote val to addr for the instruction at pc */
+void cosim_write(cosim_ptr c, word_t pc, word_t addr, word_t val);
+
+/* The instruction at pc left the processor with status stat and
+   register file r, where register pending may still be written (by the
+   second half of a split popl).  Return FALSE at the first divergence
+   from the ISA, described in c->msg */
+bool_t cosim_retire(cosim_ptr c, word_t pc, stat_t stat, mem_t r,
+		    reg_id_t pending);
+
 /************************ Interface Functions *************/
 
 #ifdef HAS_GUI
@@ -26,6 +26,9 @@ static int sym_count = 0;
 /* Optional simulator name */
 char simname[MAXBUF] = "";
 
+/* Optimize the generated C code (-O, C output only) */
+int opt = 0;
+
 #ifdef UCLID
 int annotate = 0;
 /* Keep list of argument names encountered in node definition */
@@ -49,9 +52,11 @@ static void usage(char *name)
     fprintf(stderr, "Usage: %s [-ah] < HCL_file  >uclid file\n", name);
     fprintf(stderr, "Output uclid code on stdout.\n");
 #else /* !UCLID */
-    fprintf(stderr, "Usage: %s [-h] < HCL_file  >C file\n", name);
+    fprintf(stderr, "Usage: %s [-hO] < HCL_file  >C file\n", name);
     fprintf(stderr, "Output C file on stdout.\n");
     fprintf(stderr, "   -a     Add define/use annotations\n");
+    fprintf(stderr, "   -O     Share common subexpressions, test sets with bit masks\n");
+    fprintf(stderr, "          and fuse the stall/bubble logic into compute_control()\n");
 #endif /* UCLID */
 #endif /* VLOG */
     fprintf(stderr, "   -h     Print this message\n");
@@ -68,7 +73,7 @@ void init_node(int argc, char **argv)
     int other_indents = 2;
 
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "hna")) != -1) {
+    while ((c = getopt(argc, argv, "hnaO")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -80,6 +85,11 @@ void init_node(int argc, char **argv)
 	case 'a':
 	    annotate = 1;
 	    break;
+#endif
+#if !defined(VLOG) && !defined(UCLID)
+	case 'O':
+	    opt = 1;
+	    break;
 #endif
 	default:
 	    printf("Invalid option '%c'\n", c);
@@ -94,6 +104,12 @@ void init_node(int argc, char **argv)
 	printf("char simname[] = \"Y86 Processor\";\n");
     else
 	printf("char simname[] = \"Y86 Processor: %s\";\n", simname);
+    if (opt) {
+	/* Set membership as a bit test, for members that are constants < 32 */
+	printf("#define HCL_BIT(c) (1u << (c))\n");
+	printf("#define HCL_IN(x, mask) "
+	       "(((mask) >> ((x) & 31)) & ((unsigned) (x) < 32))\n");
+    }
 #endif
     outgen_init(outfile, max_column, first_indent, other_indents);
 }
@@ -120,6 +136,8 @@ static void show_node(node_ptr node)
 }
 
 
+static void gen_control(void);
+
 void finish_node(int check_ref)
 {
     if (check_ref) {
@@ -130,6 +148,8 @@ void finish_node(int check_ref)
 			sym_tab[0][i]->sval);
 	    }
     }
+    if (opt)
+	gen_control();
 }
 
 static node_ptr find_symbol(char *name)
@@ -181,6 +201,7 @@ static node_ptr new_node(node_type_t t, int isbool,
     result->arg1 = a1;
     result->arg2 = a2;
     result->ref = 0;
+    result->vn = -1;
     result->next = NULL;
     return result;
 }
@@ -477,10 +498,237 @@ static char *show_expr(node_ptr expr)
     return expr_buf;
 }
 
+/*
+ * Common subexpressions (-O).  Structurally equal expressions get the
+ * same value number; within one generated function, each one used more
+ * than once is computed into a temporary 'tN' first.
+ */
+#define VN_LIM 4000
+#define VN_LIST (-1)	/* Pseudo type: a list of set members */
+
+typedef struct {
+    int type;
+    char *sval;
+    int a, b, c;	/* Value numbers of the operands, -1 if none */
+    int count;		/* Uses in the function being generated */
+    int visited;
+    int temp;		/* Temporary holding the value, -1 if none */
+} vn_rec;
+
+static vn_rec vn_tab[VN_LIM];
+static int vn_count = 0;
+static int temp_count = 0;
+static int defining = -1;	/* Value number of the temporary being defined */
+
+static int vn_lookup(int type, char *sval, int a, int b, int c)
+{
+    int i;
+    for (i = 0; i < vn_count; i++)
+	if (vn_tab[i].type == type && vn_tab[i].a == a && vn_tab[i].b == b &&
+	    vn_tab[i].c == c &&
+	    (vn_tab[i].sval == sval ||
+	     (sval && vn_tab[i].sval && strcmp(vn_tab[i].sval, sval) == 0)))
+	    return i;
+    if (vn_count >= VN_LIM) {
+	yyerror("Expression table limit exceeded");
+	exit(1);
+    }
+    vn_tab[i].type = type;
+    vn_tab[i].sval = sval;
+    vn_tab[i].a = a;
+    vn_tab[i].b = b;
+    vn_tab[i].c = c;
+    vn_tab[i].temp = -1;
+    return vn_count++;
+}
+
+static int number(node_ptr expr);
+
+/* Value number of the list of set members starting at ele */
+static int number_list(node_ptr ele)
+{
+    int rest = ele->next ? number_list(ele->next) : -1;
+    return vn_lookup(VN_LIST, NULL, number(ele), rest, -1);
+}
+
+static int number(node_ptr expr)
+{
+    int a = -1, b = -1, c = -1;
+    switch(expr->type) {
+    case N_NOT:
+	a = number(expr->arg1);
+	break;
+    case N_AND:
+    case N_OR:
+    case N_COMP:
+	a = number(expr->arg1);
+	b = number(expr->arg2);
+	break;
+    case N_ELE:
+	a = number(expr->arg1);
+	b = number_list(expr->arg2);
+	break;
+    case N_CASE:
+	/* A case node stands for the rest of the list */
+	a = number(expr->arg1);
+	b = number(expr->arg2);
+	c = expr->next ? number(expr->next) : -1;
+	break;
+    default:
+	break;
+    }
+    expr->vn = vn_lookup(expr->type, expr->sval, a, b, c);
+    return expr->vn;
+}
+
+/* Count uses, looking into an expression only at its first use */
+static void count_uses(node_ptr expr)
+{
+    node_ptr ele;
+    if (vn_tab[expr->vn].count++ > 0)
+	return;
+    switch(expr->type) {
+    case N_NOT:
+	count_uses(expr->arg1);
+	break;
+    case N_AND:
+    case N_OR:
+    case N_COMP:
+	count_uses(expr->arg1);
+	count_uses(expr->arg2);
+	break;
+    case N_ELE:
+	count_uses(expr->arg1);
+	for (ele = expr->arg2; ele; ele = ele->next)
+	    count_uses(ele);
+	break;
+    case N_CASE:
+	/* Only whole case expressions are shared, not their tails */
+	for (ele = expr; ele; ele = ele->next) {
+	    count_uses(ele->arg1);
+	    count_uses(ele->arg2);
+	}
+	break;
+    default:
+	break;
+    }
+}
+
+static void gen_expr(node_ptr expr);
+
+/* Define the temporaries used by expr, operands before their users */
+static void gen_temps(node_ptr expr)
+{
+    node_ptr ele;
+    vn_rec *v = &vn_tab[expr->vn];
+    if (v->visited)
+	return;
+    v->visited = 1;
+    switch(expr->type) {
+    case N_NOT:
+	gen_temps(expr->arg1);
+	break;
+    case N_AND:
+    case N_OR:
+    case N_COMP:
+	gen_temps(expr->arg1);
+	gen_temps(expr->arg2);
+	break;
+    case N_ELE:
+	gen_temps(expr->arg1);
+	for (ele = expr->arg2; ele; ele = ele->next)
+	    gen_temps(ele);
+	break;
+    case N_CASE:
+	for (ele = expr; ele; ele = ele->next) {
+	    gen_temps(ele->arg1);
+	    gen_temps(ele->arg2);
+	}
+	break;
+    default:
+	/* Variables and numbers are never worth a temporary */
+	return;
+    }
+    if (v->count > 1) {
+	outgen_print("    int t%d = ", temp_count);
+	defining = expr->vn;
+	gen_expr(expr);
+	defining = -1;
+	outgen_print(";");
+	outgen_terminate();
+	v->temp = temp_count++;
+    }
+}
+
+/* Start a function computing exprs[0..n-1]: define their common parts */
+static void gen_common(node_ptr *exprs, int n)
+{
+    int i;
+    for (i = 0; i < vn_count; i++) {
+	vn_tab[i].count = vn_tab[i].visited = 0;
+	vn_tab[i].temp = -1;
+    }
+    temp_count = 0;
+    for (i = 0; i < n; i++)
+	number(exprs[i]);
+    for (i = 0; i < n; i++)
+	count_uses(exprs[i]);
+    for (i = 0; i < n; i++)
+	gen_temps(exprs[i]);
+}
+
+/* Is expr a constant that can be a bit of a set mask (-O)?  That is a
+   number below 32, or one of the small enumerations of isa.h, whose
+   values are known to be below 32: I_*, REG_* and STAT_* */
+static int is_mask_const(node_ptr expr)
+{
+    static char *prefix[] = { "I_", "REG_", "STAT_" };
+    char *s;
+    int i, n;
+    if (expr->type == N_NUM) {
+	n = atoi(expr->sval);
+	return n >= 0 && n < 32;
+    }
+    if (expr->type != N_VAR)
+	return 0;
+    for (i = 0; i < sym_count; i++)
+	if (strcmp(expr->sval, sym_tab[0][i]->sval) == 0)
+	    break;
+    if (i == sym_count)
+	return 0;
+    s = sym_tab[1][i]->sval;
+    for (i = 0; i < 3; i++)
+	if (strncmp(s, prefix[i], strlen(prefix[i])) == 0)
+	    break;
+    if (i == 3)
+	return 0;
+    for (; *s; s++)
+	if (!isupper((int) *s) && !isdigit((int) *s) && *s != '_')
+	    return 0;
+    return 1;
+}
+
+/* Pipeline control signals (-O), generated together in compute_control() */
+static node_ptr ctl_var[SYM_LIM];
+static node_ptr ctl_expr[SYM_LIM];
+static int ctl_count = 0;
+
+static int is_control(char *name)
+{
+    int len = strlen(name);
+    return (len > 6 && strcmp(name+len-6, "_stall") == 0) ||
+	(len > 7 && strcmp(name+len-7, "_bubble") == 0);
+}
+
 /* Recursively generate code for function */
 static void gen_expr(node_ptr expr)
 {
     node_ptr ele;
+    if (opt && expr->vn >= 0 && vn_tab[expr->vn].temp >= 0 &&
+	expr->vn != defining) {
+	outgen_print("t%d", vn_tab[expr->vn].temp);
+	return;
+    }
     switch(expr->type) {
     case N_QUOTE:
 	yyserror("Unexpected quoted string", expr->sval);
@@ -542,10 +790,14 @@ static void gen_expr(node_ptr expr)
     case N_NOT:
 #if defined(VLOG) || defined(UCLID)
 	outgen_print("~");
+	gen_expr(expr->arg1);
 #else
-	outgen_print("!");
-#endif
+	/* With -O the operand may be a temporary, as in !t0 & t1 */
+	outgen_print(opt ? "(!" : "!");
 	gen_expr(expr->arg1);
+	if (opt)
+	    outgen_print(")");
+#endif
 	break;
     case N_COMP:
 	outgen_print("(");
@@ -568,6 +820,43 @@ static void gen_expr(node_ptr expr)
     case N_ELE:
 	outgen_print("(");
 	outgen_upindent();
+#if !defined(VLOG) && !defined(UCLID)
+	if (opt) {
+	    /* Constant members as one bit test, the others compared */
+	    int nconst = 0, first = 1;
+	    for (ele = expr->arg2; ele; ele=ele->next)
+		nconst += is_mask_const(ele);
+	    if (nconst > 1) {
+		outgen_print("HCL_IN(");
+		gen_expr(expr->arg1);
+		outgen_print(", ");
+		for (ele = expr->arg2; ele; ele=ele->next) {
+		    if (!is_mask_const(ele))
+			continue;
+		    if (!first)
+			outgen_print(" | ");
+		    outgen_print("HCL_BIT(");
+		    gen_expr(ele);
+		    outgen_print(")");
+		    first = 0;
+		}
+		outgen_print(")");
+	    }
+	    for (ele = expr->arg2; ele; ele=ele->next) {
+		if (nconst > 1 && is_mask_const(ele))
+		    continue;
+		if (!first)
+		    outgen_print(" || ");
+		gen_expr(expr->arg1);
+		outgen_print(" == ");
+		gen_expr(ele);
+		first = 0;
+	    }
+	    outgen_print(")");
+	    outgen_downindent();
+	    break;
+	}
+#endif
 	for (ele = expr->arg2; ele; ele=ele->next) {
 	    gen_expr(expr->arg1);
 #ifdef UCLID
@@ -693,6 +982,13 @@ void gen_funct(node_ptr var, node_ptr expr, int isbool)
     outgen_terminate();
     outgen_print("{");
     outgen_terminate();
+    if (opt) {
+	gen_common(&expr, 1);
+	if (is_control(var->sval) && ctl_count < SYM_LIM) {
+	    ctl_var[ctl_count] = var;
+	    ctl_expr[ctl_count++] = expr;
+	}
+    }
     outgen_print("    return ");
     gen_expr(expr);
     outgen_print(";");
@@ -703,3 +999,33 @@ void gen_funct(node_ptr var, node_ptr expr, int isbool)
 #endif /* UCLID */
 #endif /* VLOG */
 }
+
+/*
+ * Generate compute_control() (-O): all the stall and bubble signals in
+ * one function, sharing their common subexpressions, leaving the results
+ * in ctl_<signal> for the simulator to read
+ */
+static void gen_control(void)
+{
+    int i;
+    if (!ctl_count)
+	return;
+    for (i = 0; i < ctl_count; i++) {
+	outgen_print("int ctl_%s;", ctl_var[i]->sval);
+	outgen_terminate();
+    }
+    outgen_terminate();
+    outgen_print("void compute_control()");
+    outgen_terminate();
+    outgen_print("{");
+    outgen_terminate();
+    gen_common(ctl_expr, ctl_count);
+    for (i = 0; i < ctl_count; i++) {
+	outgen_print("    ctl_%s = ", ctl_var[i]->sval);
+	gen_expr(ctl_expr[i]);
+	outgen_print(";");
+	outgen_terminate();
+    }
+    outgen_print("}");
+    outgen_terminate();
+}
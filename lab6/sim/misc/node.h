@@ -8,6 +8,7 @@ typedef struct NODE {
     struct NODE *arg1;
     struct NODE *arg2;
     int ref;     /* For var, how many times has it been referenced? */
+    int vn;      /* Value number (hcl2c -O), -1 until numbered */
     struct NODE *next;
 } node_rec, *node_ptr;
 
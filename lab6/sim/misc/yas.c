@@ -26,6 +26,49 @@ int vcode = 0;
 /* Should it generate code for banked memory? */
 int block_factor = 0;
 
+/* Generate a binary object (.ybo) instead of a listing? */
+int bcode = 0;
+
+/* The binary object: its segments and their bytes, in order */
+ybo_seg_t *bin_segs = NULL;
+int bin_nseg = 0, bin_segmax = 0;
+byte_t *bin_code = NULL;
+int bin_bytes = 0, bin_max = 0;
+
+/* Add the len bytes of code at address pos to the binary object */
+static void bin_add(int pos, char *code, int len)
+{
+    ybo_seg_t *last = bin_nseg ? &bin_segs[bin_nseg-1] : NULL;
+    if (!last || last->addr + last->len != pos) {
+	if (bin_nseg == bin_segmax) {
+	    bin_segmax = bin_segmax ? 2*bin_segmax : 16;
+	    bin_segs = realloc(bin_segs, bin_segmax * sizeof(ybo_seg_t));
+	}
+	last = &bin_segs[bin_nseg++];
+	last->addr = pos;
+	last->len = 0;
+    }
+    if (bin_bytes + len > bin_max) {
+	bin_max = bin_max ? 2*bin_max : 1024;
+	bin_code = realloc(bin_code, bin_max);
+    }
+    memcpy(bin_code + bin_bytes, code, len);
+    bin_bytes += len;
+    last->len += len;
+}
+
+/* Write the binary object (see isa.h) */
+static void bin_write(FILE *out)
+{
+    ybo_hdr_t hdr;
+    memcpy(hdr.magic, YBO_MAGIC, sizeof(hdr.magic));
+    hdr.nseg = bin_nseg;
+    hdr.bytes = bin_bytes;
+    fwrite(&hdr, sizeof(hdr), 1, out);
+    fwrite(bin_segs, sizeof(ybo_seg_t), bin_nseg, out);
+    fwrite(bin_code, 1, bin_bytes, out);
+}
+
 int lineno = 1; /* Line number of input file */
 int bytepos = 0; /* Address of current instruction being processed */
 int error_mode = 0; /* Am I trying to finish off a line with an error? */
@@ -136,6 +179,11 @@ static void hexstuff(char *dest, int value, int len)
 
 void print_code(FILE *out, int pos)
 {
+    if (bcode) {
+	if (tcount && bcount)
+	    bin_add(pos, code, bcount);
+	return;
+    }
 #ifdef BIG_MEM
     /* Printing format:
        0xHHHH: cccccccccccc | <line>
@@ -536,8 +584,9 @@ int yylex();
 
 static void usage(char *pname)
 {
-    printf("Usage: %s [-V[n]] file.ys\n", pname);
+    printf("Usage: %s [-V[n]|-b] file.ys\n", pname);
     printf("   -V[n]  Generate memory initialization in Verilog format (n-way blocking)\n");
+    printf("   -b     Generate a binary object file.ybo instead of file.yo\n");
     exit(0);
 }
 
@@ -563,6 +612,10 @@ int main(int argc, char *argv[])
 	}
 	nextarg++;
 	break;
+      case 'b':
+	bcode = 1;
+	nextarg++;
+	break;
       default:
 	usage(argv[0]);
       }
@@ -587,7 +640,7 @@ int main(int argc, char *argv[])
       outfile = stdout;
     } else {
       strncpy(outfname, argv[nextarg], rootlen);
-      strcpy(outfname+rootlen, ".yo");
+      strcpy(outfname+rootlen, bcode ? ".ybo" : ".yo");
       outfile = fopen(outfname, "w");
       if (!outfile) {
 	fprintf(stderr, "Can't open output file '%s'\n", outfname);
@@ -615,6 +668,8 @@ int main(int argc, char *argv[])
 
     yylex();
     fclose(yyin);
+    if (bcode)
+	bin_write(outfile);
     fclose(outfile);
     return hit_error;
 }
@@ -44,8 +44,7 @@ int main(int argc, char *argv[])
     if (argc > 2)
 	max_steps = atoi(argv[2]);
 
-    for (step = 0; step < max_steps && e == STAT_AOK; step++)
-	e = step_state(s, stdout);
+    e = run_state(s, max_steps, &step, stdout);
 
     printf("Stopped in %d steps at PC = 0x%x.  Status '%s', CC %s\n",
 	   step, s->pc, stat_name(e), cc_name(s->cc));
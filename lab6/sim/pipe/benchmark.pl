@@ -13,6 +13,10 @@ use Getopt::Std;
 $blocklen = 64;
 $yas = "../misc/yas";
 $pipe = "./psim";
+# Use the headless simulator when it has been built
+if (-x "./psim-batch") {
+    $pipe = "./psim-batch";
+}
 $gendriver = "./gen-driver.pl";
 $fname = "bdriver";
 $verbose = 1;
@@ -14,6 +14,10 @@ $over = 3;
 $yas = "../misc/yas";
 $yis = "../misc/yis";
 $pipe = "./psim";
+# Use the headless simulator when it has been built
+if (-x "./psim-batch") {
+    $pipe = "./psim-batch";
+}
 $gendriver = "./gen-driver.pl";
 $fname = "cdriver";
 $verbose = 1;
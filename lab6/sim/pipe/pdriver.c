@@ -0,0 +1,392 @@
+/***********************************************************************
+ * pdriver.c - Parallel correctness and benchmark driver for PIPE
+ *
+ * Does the work of benchmark.pl and correctness.pl for several PIPE
+ * variants at once.  Each variant is psim built as a shared library
+ * (make pipe-xxx.so), loaded privately so that it keeps its own
+ * simulator state.  Every (variant, program) run happens in a forked
+ * worker, at most -j of them at a time.
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "isa.h"
+
+#define MAXBUF 1024
+#define MAXVAR 32
+
+/* Configuration, as in benchmark.pl and correctness.pl */
+static int blocklen = 64;
+static int over = 3;
+static int bytelim = 1000;
+static char *gendriver = "perl ./gen-driver.pl";
+static char *yas = "../misc/yas";
+static double fullcpe = 10.0;
+static double threshcpe = 12.5;
+static double totalpoints = 60;
+
+/* Entry point of each variant (psim.c, PSIM_LIB) */
+typedef int (*run_fn)(char *fname, int *eaxp, int *cyclesp, int *instrp,
+		      char *diverged);
+
+typedef struct {
+    char *name;
+    run_fn run;
+} variant_t;
+
+static variant_t variants[MAXVAR];
+static int nvariants = 0;
+
+/* One program, run on every variant */
+typedef struct {
+    int len;		/* Number of elements */
+    int check;		/* Correctness driver (-rc) or benchmark driver? */
+    char ys[MAXBUF];
+    char yo[MAXBUF];
+} program_t;
+
+/* Result of one run, written by the worker into shared memory */
+typedef struct {
+    int done;		/* Did the worker finish? */
+    int status;		/* Final status, -1 if the program didn't load */
+    int eax;
+    int cycles;
+    int instructions;
+    char diverged[128];	/* First difference from the ISA, if any */
+} result_t;
+
+static program_t *programs;
+static int nprograms = 0;
+static result_t *results;	/* nvariants x nprograms */
+static char tmpdir[] = "pdriver.XXXXXX";
+static char *ncopy = "ncopy.ys";
+
+static void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-hq] [-j J] [-n N] [-b blim] [-f FILE] pipe-xxx.so ...\n", name);
+    fprintf(stderr, "   -h      Print help message\n");
+    fprintf(stderr, "   -q      Only print the summary lines\n");
+    fprintf(stderr, "   -j J    Run at most J simulations at once (default: number of cores)\n");
+    fprintf(stderr, "   -n N    Set max number of elements up to 64 (default %d)\n", blocklen);
+    fprintf(stderr, "   -f FILE Input .ys file is FILE (default %s)\n", ncopy);
+    fprintf(stderr, "   -b blim Set byte limit for function (default %d)\n", bytelim);
+    exit(1);
+}
+
+/* Load the variant in library file fname */
+static void add_variant(char *fname)
+{
+    char path[MAXBUF];
+    char *base;
+    void *lib;
+
+    if (nvariants == MAXVAR) {
+	fprintf(stderr, "Too many variants (max %d)\n", MAXVAR);
+	exit(1);
+    }
+    /* dlopen only searches the current directory when told to */
+    snprintf(path, MAXBUF, "%s%s", strchr(fname, '/') ? "" : "./", fname);
+    lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!lib) {
+	fprintf(stderr, "%s\n", dlerror());
+	exit(1);
+    }
+    variants[nvariants].run = (run_fn) dlsym(lib, "sim_run_file");
+    if (!variants[nvariants].run) {
+	fprintf(stderr, "%s: not built with PSIM_LIB\n", fname);
+	exit(1);
+    }
+    base = strrchr(fname, '/');
+    base = strdup(base ? base+1 : fname);
+    if (strrchr(base, '.'))
+	*strrchr(base, '.') = '\0';
+    variants[nvariants++].name = base;
+}
+
+/*
+ * run_jobs - run job(0) .. job(njobs-1), each in its own child process,
+ * with at most nworkers of them at once.  Returns how many failed
+ */
+static int run_jobs(int njobs, int nworkers, void (*job)(int))
+{
+    int next = 0, running = 0, failed = 0, wstatus;
+
+    while (next < njobs || running > 0) {
+	while (next < njobs && running < nworkers) {
+	    pid_t pid = fork();
+	    if (pid < 0) {
+		perror("fork");
+		exit(1);
+	    }
+	    if (pid == 0) {
+		job(next);
+		exit(0);
+	    }
+	    next++;
+	    running++;
+	}
+	if (wait(&wstatus) > 0) {
+	    running--;
+	    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+		failed++;
+	}
+    }
+    return failed;
+}
+
+/* Generate and assemble the driver for program i */
+static void make_program(int i)
+{
+    program_t *p = &programs[i];
+    char cmd[3*MAXBUF];
+
+    if (p->check)
+	snprintf(cmd, sizeof(cmd), "%s -rc -n %d -f %s -b %d > %s",
+		 gendriver, p->len, ncopy, bytelim, p->ys);
+    else
+	snprintf(cmd, sizeof(cmd), "%s -n %d -f %s > %s",
+		 gendriver, p->len, ncopy, p->ys);
+    if (system(cmd) != 0) {
+	fprintf(stderr, "Couldn't generate driver file %s\n", p->ys);
+	exit(1);
+    }
+    snprintf(cmd, sizeof(cmd), "%s %s", yas, p->ys);
+    if (system(cmd) != 0) {
+	fprintf(stderr, "Couldn't assemble file %s\n", p->ys);
+	exit(1);
+    }
+}
+
+/* Simulate run j: program j % nprograms on variant j / nprograms */
+static void simulate(int j)
+{
+    result_t *r = &results[j];
+    program_t *p = &programs[j % nprograms];
+
+    /* No output from the simulator itself */
+    if (!freopen("/dev/null", "w", stdout))
+	exit(1);
+    r->status = variants[j / nprograms].run(p->yo, &r->eax, &r->cycles,
+					    &r->instructions, r->diverged);
+    r->done = 1;
+}
+
+static void add_program(int len, int check)
+{
+    program_t *p = &programs[nprograms++];
+    p->len = len;
+    p->check = check;
+    snprintf(p->ys, MAXBUF, "%s/%cdriver%d.ys", tmpdir, check ? 'c' : 'b',
+	     len);
+    snprintf(p->yo, MAXBUF, "%s/%cdriver%d.yo", tmpdir, check ? 'c' : 'b',
+	     len);
+}
+
+/* Why run r did not halt normally, NULL if it did */
+static char *abnormal(result_t *r)
+{
+    static char *stat_names[] = { "BUB", "limit", "HLT", "ADR", "INS", "PIP" };
+    if (!r->done)
+	return "crashed";
+    if (r->status < 0)
+	return "noload";
+    if (r->status != STAT_HLT)
+	return r->status <= STAT_PIP ? stat_names[r->status] : "failed";
+    return NULL;
+}
+
+/* Correctness verdict, from the value the checking code leaves in %eax
+   and the lockstep check against the ISA */
+static char *verdict(result_t *r)
+{
+    if (abnormal(r))
+	return abnormal(r);
+    if (r->diverged[0])
+	return "diverged";
+    switch (r->eax) {
+    case 0xaaaa: return "OK";
+    case 0xbbbb: return "count";
+    case 0xcccc: return "toolong";
+    case 0xdddd: return "copy";
+    case 0xeeee: return "corrupt";
+    default:     return "failed";
+    }
+}
+
+/* Average CPE of variant v over benchmark programs 1..nbench-1, or -1 if
+   one of them did not halt normally or there are none (-n 0) */
+static double average_cpe(int v, int nbench)
+{
+    double tcpe = 0;
+    int i;
+    if (blocklen == 0)
+	return -1;
+    for (i = 1; i < nbench; i++) {
+	result_t *r = &results[v*nprograms + i];
+	if (abnormal(r))
+	    return -1;
+	tcpe += (double) r->cycles / programs[i].len;
+    }
+    return tcpe / blocklen;
+}
+
+int main(int argc, char *argv[])
+{
+    double acpe[MAXVAR];
+    int c, i, v, quiet = 0;
+    int nbench, njobs;
+    long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    char cmd[MAXBUF];
+
+    while ((c = getopt(argc, argv, "hqj:n:f:b:")) != -1) {
+	switch(c) {
+	case 'q':
+	    quiet = 1;
+	    break;
+	case 'j':
+	    nworkers = atoi(optarg);
+	    break;
+	case 'n':
+	    blocklen = atoi(optarg);
+	    if (blocklen < 0 || blocklen > 64) {
+		fprintf(stderr, "n must be between 0 and 64\n");
+		exit(1);
+	    }
+	    break;
+	case 'f':
+	    ncopy = optarg;
+	    break;
+	case 'b':
+	    bytelim = atoi(optarg);
+	    break;
+	case 'h':
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind == argc || nworkers < 1)
+	usage(argv[0]);
+    for (i = optind; i < argc; i++)
+	add_variant(argv[i]);
+
+    if (!mkdtemp(tmpdir)) {
+	perror("mkdtemp");
+	exit(1);
+    }
+
+    /* Benchmark drivers 0..blocklen, then correctness drivers 0..blocklen
+       and a few longer ones */
+    programs = (program_t *) calloc(2*(blocklen+over+1), sizeof(program_t));
+    for (i = 0; i <= blocklen; i++)
+	add_program(i, 0);
+    nbench = nprograms;
+    for (i = 0; i <= blocklen+over; i++)
+	add_program(i > blocklen ? blocklen * (i - blocklen + 1) : i, 1);
+    if (run_jobs(nprograms, nworkers, make_program)) {
+	snprintf(cmd, MAXBUF, "rm -rf %s", tmpdir);
+	if (system(cmd) != 0)
+	    fprintf(stderr, "Couldn't remove %s\n", tmpdir);
+	exit(1);
+    }
+
+    njobs = nvariants * nprograms;
+    results = (result_t *) mmap(NULL, njobs * sizeof(result_t),
+				PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+	perror("mmap");
+	exit(1);
+    }
+    run_jobs(njobs, nworkers, simulate);
+
+    snprintf(cmd, MAXBUF, "rm -rf %s", tmpdir);
+    if (system(cmd) != 0)
+	fprintf(stderr, "Couldn't remove %s\n", tmpdir);
+
+    /* CPE table: cycles per element for each block length */
+    printf("%s: cycles (CPE) for each number of elements\n", ncopy);
+    if (!quiet) {
+	printf("%-8s", "n");
+	for (v = 0; v < nvariants; v++)
+	    printf("%18s", variants[v].name);
+	printf("\n");
+	for (i = 0; i < nbench; i++) {
+	    printf("%-8d", programs[i].len);
+	    for (v = 0; v < nvariants; v++) {
+		result_t *r = &results[v*nprograms + i];
+		if (abnormal(r))
+		    printf("%18s", abnormal(r));
+		else if (programs[i].len > 0)
+		    printf("%10d (%5.2f)", r->cycles,
+			   (double) r->cycles / programs[i].len);
+		else
+		    printf("%18d", r->cycles);
+	    }
+	    printf("\n");
+	}
+    }
+    printf("%-8s", "CPE");
+    for (v = 0; v < nvariants; v++) {
+	acpe[v] = average_cpe(v, nbench);
+	if (acpe[v] < 0)
+	    printf("%18s", "-");
+	else
+	    printf("%18.2f", acpe[v]);
+    }
+    printf("\n%-8s", "Score");
+    for (v = 0; v < nvariants; v++) {
+	double score = 0;
+	if (acpe[v] < 0) {
+	    printf("%18s", "-");
+	    continue;
+	}
+	if (acpe[v] <= fullcpe)
+	    score = totalpoints;
+	else if (acpe[v] <= threshcpe)
+	    score = totalpoints * (threshcpe - acpe[v])/(threshcpe - fullcpe);
+	printf("%15.1f/%-2.0f", score, totalpoints);
+    }
+
+    /* Correctness matrix */
+    printf("\n\n%s: correctness for each number of elements\n", ncopy);
+    if (!quiet) {
+	printf("%-8s", "n");
+	for (v = 0; v < nvariants; v++)
+	    printf("%18s", variants[v].name);
+	printf("\n");
+	for (i = nbench; i < nprograms; i++) {
+	    printf("%-8d", programs[i].len);
+	    for (v = 0; v < nvariants; v++)
+		printf("%18s", verdict(&results[v*nprograms + i]));
+	    printf("\n");
+	}
+    }
+    printf("%-8s", "Pass");
+    for (v = 0; v < nvariants; v++) {
+	int good = 0;
+	for (i = nbench; i < nprograms; i++)
+	    good += strcmp(verdict(&results[v*nprograms + i]), "OK") == 0;
+	printf("%15d/%-2d", good, nprograms - nbench);
+    }
+    printf("\n");
+
+    /* Where each variant first left the ISA */
+    for (v = 0; v < nvariants; v++) {
+	for (i = 0; i < nprograms; i++) {
+	    result_t *r = &results[v*nprograms + i];
+	    if (r->done && r->diverged[0]) {
+		printf("%s: %s n=%d diverges, %s\n", variants[v].name,
+		       programs[i].check ? "correctness" : "benchmark",
+		       programs[i].len, r->diverged);
+		break;
+	    }
+	}
+    }
+    return 0;
+}
@@ -13,6 +13,10 @@
 
 #include <stdio.h>
 
+/* Cycles of bubbles in W before the first instruction gets there, when
+   fetch does not miss.  Performance counts start from then */
+#define PIPE_FILL 4
+
 /******************************************************************************
  *	typedefs
  ******************************************************************************/
@@ -15,10 +15,18 @@
 #include "pipeline.h"
 #include "stages.h"
 #include "sim.h"
+#include "ptrace.h"
 
 #define MAXBUF 1024
 #define DEFAULTNAME "Y86 Simulator: "
 
+#ifdef PSIM_BATCH
+/* Headless batch engine: no GUI and no cycle trace.  Logging compiles
+   to nothing, so its arguments are never even formatted */
+#undef HAS_GUI
+#define sim_log(...) ((void) 0)
+#endif /* PSIM_BATCH */
+
 #ifdef HAS_GUI
 #include <tk.h>
 #endif /* HAS_GUI */
@@ -40,9 +48,22 @@ extern  char simname[];
 int gui_mode = FALSE;    /* Run in GUI mode instead of TTY mode? (-g) */
 char *object_filename;   /* The input object file name. */
 FILE *object_file;       /* Input file handle */
+#ifdef PSIM_BATCH
+bool_t verbosity = 1;    /* Verbosity level, no cycle trace in batch (-v) */
+#define MAX_VERBOSITY 1
+#else
 bool_t verbosity = 2;    /* Verbosity level [TTY only] (-v) */ 
+#define MAX_VERBOSITY 2
+#endif
 int instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
 bool_t do_check = FALSE; /* Test with ISA simulator? [TTY only] (-t) */
+static cosim_ptr cosim = NULL; /* ISA stepped in lockstep (-t, PSIM_LIB) */
+char *trace_filename = NULL; /* Binary cycle trace [TTY only] (-T) */
+bool_t hazard_stats = FALSE; /* Stall/bubble statistics [TTY only] (-s) */
+char *predictor = NULL;  /* Branch predictor and its accuracy (-p) */
+char *icache_spec = NULL; /* L1 instruction cache, as s:E:b (-I) */
+char *dcache_spec = NULL; /* L1 data cache, as s:E:b (-D) */
+int miss_penalty = 10;   /* Cycles lost on a cache miss (-m) */
 
 /************* 
  * End Globals 
@@ -55,6 +76,24 @@ bool_t do_check = FALSE; /* Test with ISA simulator? [TTY only] (-t) */
 
 static void usage(char *name);           /* Print helpful usage message */
 static void run_tty_sim();               /* Run simulator in TTY mode */
+static void trace_open();                /* Start the binary cycle trace */
+static void trace_close();               /* Flush and close it */
+static void trace_cycle(int cyc);        /* Record one cycle in it */
+static void hazard_cycle();              /* Attribute this cycle's stalls */
+static void hazard_reset();              /* Clear the statistics */
+static void hazard_report();             /* Print the CPI breakdown */
+static bool_t bp_parse(char *spec);      /* Select the branch predictor */
+static bool_t bp_followed();             /* Does fetch use its predictions? */
+static void bp_reset();                  /* Forget all branch history */
+static void bp_fetch();                  /* Predict the fetched instr */
+static void bp_accept();                 /* It has been loaded into D */
+static void bp_retire();                 /* Score the instruction in W */
+static void bp_report();                 /* Print the prediction accuracy */
+static void cache_cycle();               /* Stall for cache misses */
+static void cache_reset();               /* Empty the caches */
+static void cache_report();              /* Print the hit rates */
+static bool_t cosim_retire_wb();         /* Check the instruction in W */
+static void print_pipe();                /* Print the pipeline registers */
 
 #ifdef HAS_GUI
 void addAppCommands(Tcl_Interp *interp); /* Add application-dependent commands */
@@ -84,7 +123,7 @@ int sim_main(int argc, char **argv)
 
     
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "htgl:v:")) != -1) {
+    while ((c = getopt(argc, argv, "htgsl:v:T:p:I:D:m:")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -94,7 +133,7 @@ int sim_main(int argc, char **argv)
 	    break;
 	case 'v':
 	    verbosity = atoi(optarg);
-	    if (verbosity < 0 || verbosity > 2) {
+	    if (verbosity < 0 || verbosity > MAX_VERBOSITY) {
 		printf("Invalid verbosity %d\n", verbosity);
 		usage(argv[0]);
 	    }
@@ -102,6 +141,32 @@ int sim_main(int argc, char **argv)
 	case 't':
 	    do_check = TRUE;
 	    break;
+	case 'T':
+	    trace_filename = optarg;
+	    break;
+	case 's':
+	    hazard_stats = TRUE;
+	    break;
+	case 'p':
+	    predictor = optarg;
+	    if (!bp_parse(predictor)) {
+		printf("Invalid predictor '%s'\n", predictor);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'I':
+	    icache_spec = optarg;
+	    break;
+	case 'D':
+	    dcache_spec = optarg;
+	    break;
+	case 'm':
+	    miss_penalty = atoi(optarg);
+	    if (miss_penalty < 1) {
+		printf("Invalid miss penalty %d\n", miss_penalty);
+		usage(argv[0]);
+	    }
+	    break;
 	case 'g':
 	    gui_mode = TRUE;
 	    break;
@@ -184,8 +249,8 @@ static void run_tty_sim()
     byte_t run_status = STAT_AOK;
     cc_t result_cc = 0;
     int byte_cnt = 0;
+    bool_t cut_short;
     mem_t mem0, reg0;
-    state_ptr isa_state = NULL;
 
 
     /* In TTY mode, the default object file comes from stdin */
@@ -196,6 +261,11 @@ static void run_tty_sim()
     if (verbosity >= 2)
 	sim_set_dumpfile(stdout);
     sim_init();
+    if (predictor && !bp_followed()) {
+	fprintf(stderr, "This PIPE variant does not take its predictions "
+		"from psim: -p needs pipe-pred.hcl\n");
+	exit(1);
+    }
 
     /* Emit simulator name */
     if (verbosity >= 2)
@@ -209,19 +279,23 @@ static void run_tty_sim()
 	printf("%d bytes of code read\n", byte_cnt);
     }
     fclose(object_file);
-    if (do_check) {
-	isa_state = new_state(0);
-	free_mem(isa_state->r);
-	free_mem(isa_state->m);
-	isa_state->m = copy_mem(mem);
-	isa_state->r = copy_mem(reg);
-	isa_state->cc = cc;
-    }
+    if (do_check)
+	cosim = new_cosim(mem, reg, cc, stdout);
 
     mem0 = copy_mem(mem);
     reg0 = copy_mem(reg);
     
+    trace_open();
     icount = sim_run_pipe(instr_limit, 5*instr_limit, &run_status, &result_cc);
+    trace_close();
+    /* A run still going when it reaches -l instructions, or 5 times as
+       many cycles, is cut short */
+    cut_short = (run_status == STAT_AOK || run_status == STAT_BUB) &&
+	!(cosim && cosim->failed);
+    if (cut_short)
+	printf("Run stopped by the %s limit after %d instructions "
+	       "(see -l)\n", icount < instr_limit ? "cycle" : "instruction",
+	       icount);
     if (verbosity > 0) {
 	printf("%d instructions executed\n", icount);
 	printf("Status = %s\n", stat_name(run_status));
@@ -232,36 +306,55 @@ static void run_tty_sim()
 	diff_mem(mem0, mem, stdout);
     }
     if (do_check) {
-	byte_t e = STAT_AOK;
+	state_ptr isa_state = cosim->isa;
+	byte_t e = run_status == STAT_BUB ? STAT_AOK : run_status;
 	int step;
 	bool_t match = TRUE;
+	bool_t compared = TRUE;
 
-	for (step = 0; step < instr_limit && e == STAT_AOK; step++) {
-	    e = step_state(isa_state, stdout);
-	}
-
-	if (diff_reg(isa_state->r, reg, NULL)) {
+	/* The ISA has been checked at each instruction retired so far */
+	if (cosim->failed) {
 	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Register != Pipeline Register File\n");
-		diff_reg(isa_state->r, reg, stdout);
+	    printf("Lockstep check fails after %d instructions: %s\n",
+		   cosim->steps, cosim->msg);
+	    if (verbosity > 0)
+		print_pipe();
+	} else if (cut_short && icount < instr_limit) {
+	    /* Instructions are still in flight: the final state cannot be
+	       compared with the ISA's, only each instruction retired */
+	    compared = FALSE;
+	} else {
+	    for (step = cosim->steps; step < instr_limit && e == STAT_AOK;
+		 step++) {
+		e = step_state(isa_state, stdout);
 	    }
-	}
-	if (diff_mem(isa_state->m, mem, NULL)) {
-	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Memory != Pipeline Memory\n");
-		diff_mem(isa_state->m, mem, stdout);
+
+	    if (diff_reg(isa_state->r, reg, NULL)) {
+		match = FALSE;
+		if (verbosity > 0) {
+		    printf("ISA Register != Pipeline Register File\n");
+		    diff_reg(isa_state->r, reg, stdout);
+		}
 	    }
-	}
-	if (isa_state->cc != result_cc) {
-	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
-		       cc_name(isa_state->cc), cc_name(result_cc));
+	    if (diff_mem(isa_state->m, mem, NULL)) {
+		match = FALSE;
+		if (verbosity > 0) {
+		    printf("ISA Memory != Pipeline Memory\n");
+		    diff_mem(isa_state->m, mem, stdout);
+		}
+	    }
+	    if (isa_state->cc != result_cc) {
+		match = FALSE;
+		if (verbosity > 0) {
+		    printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
+			   cc_name(isa_state->cc), cc_name(result_cc));
+		}
 	    }
 	}
-	if (match) {
+	if (!compared) {
+	    printf("ISA Check Incomplete: no divergence in %d instructions\n",
+		   cosim->steps);
+	} else if (match) {
 	    printf("ISA Check Succeeds\n");
 	} else {
 	    printf("ISA Check Fails\n");
@@ -274,6 +367,11 @@ static void run_tty_sim()
 	printf("CPI: %d cycles/%d instructions = %.2f\n",
 	       cycles, instructions, cpi);
     }
+    cache_report();
+    if (hazard_stats)
+	hazard_report();
+    if (predictor)
+	bp_report();
 
 }
 
@@ -282,13 +380,21 @@ static void run_tty_sim()
  */
 static void usage(char *name)
 {
-    printf("Usage: %s [-htg] [-l m] [-v n] file.yo\n", name);
+    printf("Usage: %s [-htgs] [-l m] [-v n] [-T file] [-p pred] [-I s:E:b] [-D s:E:b] [-m n] file.yo\n", name);
     printf("file.yo arg required in GUI mode, optional in TTY mode (default stdin)\n");
     printf("   -h     Print this message\n");
     printf("   -g     Run in GUI mode instead of TTY mode (default TTY)\n");  
-    printf("   -l m   Set instruction limit to m [TTY mode only] (default %d)\n", instr_limit);
-    printf("   -v n   Set verbosity level to 0 <= n <= 2 [TTY mode only] (default %d)\n", verbosity);
-    printf("   -t     Test result against ISA simulator [TTY mode only]\n");
+    printf("   -l m   Set instruction limit to m, and cycle limit to 5m [TTY mode only]\n");
+    printf("          (default %d)\n", instr_limit);
+    printf("   -v n   Set verbosity level to 0 <= n <= %d [TTY mode only] (default %d)\n", MAX_VERBOSITY, verbosity);
+    printf("   -t     Test against ISA simulator at every instruction [TTY mode only]\n");
+    printf("   -T f   Write a binary cycle trace to file f (see ptrace) [TTY mode only]\n");
+    printf("   -s     Print a CPI breakdown by stall/bubble cause [TTY mode only]\n");
+    printf("   -p p   Predict branches with p (taken, nt, btfnt, bimodal or gshare,\n");
+    printf("          +ras to predict ret) for pipe-pred.hcl, and report accuracy\n");
+    printf("   -I c   Model an L1 instruction cache of 2^s sets of E lines of 2^b bytes\n");
+    printf("   -D c   Model an L1 data cache, given as for -I\n");
+    printf("   -m n   Stall n cycles on each cache miss (default %d)\n", miss_penalty);
     exit(0);
 }
 
@@ -306,6 +412,8 @@ static void usage(char *name)
 
 /* Has simulator gotten past initial bubbles? */
 static int starting_up = 1;
+/* Cycles spent on them, which take PIPE_FILL without cache misses */
+static int fill_cycles = 0;
 
 /* How many cycles have been simulated? */
 int cycles = 0;
@@ -334,6 +442,7 @@ word_t wb_valM = 0;
 word_t mem_addr = 0;
 word_t mem_data = 0;
 bool_t mem_write = FALSE;
+bool_t mem_read = FALSE;
 
 /* EX Operand sources */
 mux_source_t amux = MUX_NONE;
@@ -364,6 +473,9 @@ word_t e_vala;
 word_t e_valb;
 bool_t e_bcond;
 bool_t dmem_error;
+bool_t f_ptaken;
+bool_t f_rasok;
+word_t f_raspc;
 
 /* The pipeline state */
 pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
@@ -568,7 +680,11 @@ void sim_reset()
     minAddr = 0;
     memCnt = 0;
     starting_up = 1;
+    fill_cycles = 0;
     cycles = instructions = 0;
+    hazard_reset();
+    bp_reset();
+    cache_reset();
     cc = DEFAULT_CC;
     status = STAT_AOK;
 
@@ -588,6 +704,7 @@ void sim_reset()
     mem_addr = 0;
     mem_data = 0;
     mem_write = FALSE;
+    mem_read = FALSE;
     sim_report();
 }
 
@@ -621,6 +738,8 @@ static void update_state(bool_t update_mem, bool_t update_cc)
 	    sim_log("\tCouldn't write to address 0x%x\n", mem_addr);
 	} else {
 	    sim_log("\tWrote 0x%x to address 0x%x\n", mem_data, mem_addr);
+	    if (cosim)
+		cosim_write(cosim, ex_mem_curr->stage_pc, mem_addr, mem_data);
 
 #ifdef HAS_GUI
 	    if (gui_mode) {
@@ -679,6 +798,781 @@ void tty_report(int cyc) {
 	  stat_name(mem_wb_curr->status));
 }
 
+/*****************************************************************************
+ * stall and bubble statistics (-s)
+ *****************************************************************************/
+
+/* Causes of lost cycles.  A hazard caused by one of the instructions
+   added in the homework problems is charged to that instruction */
+typedef enum { H_LOAD_USE, H_MISPREDICT, H_RET, H_IADDL, H_LEAVE, H_POP2,
+	       H_ICACHE, H_DCACHE, H_OTHER, H_CAUSES } hazard_t;
+
+static char *hazard_names[H_CAUSES] = { "load/use", "mispredict", "ret",
+					"iaddl", "leave", "popl split",
+					"icache miss", "dcache miss", "other" };
+
+/* Which cache, if any, is holding the pipeline this cycle (-I, -D) */
+typedef enum { CS_NONE, CS_ICACHE, CS_DCACHE } cache_stall_t;
+static cache_stall_t cache_stall = CS_NONE;
+
+/* Lost cycles and stalls charged to one instruction address */
+typedef struct {
+    word_t pc;
+    bool_t used;
+    byte_t instr;		/* icode:ifun of the instruction */
+    unsigned bubbles[H_CAUSES];
+    unsigned stalls;
+} hazard_pc_t;
+
+static unsigned hazard_bubbles[H_CAUSES];
+static unsigned hazard_stalls[H_CAUSES];
+static unsigned hazard_events[H_CAUSES];
+static hazard_pc_t *hazard_pcs = NULL;	/* Open addressing */
+static int hazard_size = 0, hazard_count = 0;
+
+static void hazard_reset()
+{
+    memset(hazard_bubbles, 0, sizeof(hazard_bubbles));
+    memset(hazard_stalls, 0, sizeof(hazard_stalls));
+    memset(hazard_events, 0, sizeof(hazard_events));
+    if (hazard_pcs)
+	memset(hazard_pcs, 0, hazard_size * sizeof(hazard_pc_t));
+    hazard_count = 0;
+}
+
+/* The entry of pc, added if new */
+static hazard_pc_t *hazard_find(word_t pc)
+{
+    hazard_pc_t *old = hazard_pcs;
+    int i, n = hazard_size;
+
+    if (4 * (hazard_count + 1) > 3 * hazard_size) {
+	/* keep the table at most 3/4 full */
+	hazard_size = hazard_size ? 2 * hazard_size : 64;
+	hazard_pcs = (hazard_pc_t *) calloc(hazard_size, sizeof(hazard_pc_t));
+	for (i = 0; i < n; i++)
+	    if (old[i].used)
+		*hazard_find(old[i].pc) = old[i];
+	free(old);
+    }
+    for (i = (pc * 2654435761u) & (hazard_size-1); hazard_pcs[i].used;
+	 i = (i+1) & (hazard_size-1))
+	if (hazard_pcs[i].pc == pc)
+	    return &hazard_pcs[i];
+    hazard_count++;
+    hazard_pcs[i].used = TRUE;
+    hazard_pcs[i].pc = pc;
+    return &hazard_pcs[i];
+}
+
+/* Charge bubbles and stalls to cause h and the instruction at pc */
+static void hazard_add(hazard_t h, word_t pc, byte_t instr, int bubbles,
+		       int stalls)
+{
+    hazard_pc_t *e = hazard_find(pc);
+    e->instr = instr;
+    e->bubbles[h] += bubbles;
+    e->stalls += stalls;
+    hazard_bubbles[h] += bubbles;
+    hazard_stalls[h] += stalls;
+    hazard_events[h]++;
+}
+
+/* The cause to charge for a hazard of kind h, created by instruction icode */
+static hazard_t hazard_cause(hazard_t h, byte_t icode)
+{
+    switch (icode) {
+    case I_IADDL: return H_IADDL;
+    case I_LEAVE: return H_LEAVE;
+    case I_POP2:  return H_POP2;
+    default:      return h;
+    }
+}
+
+/*
+ * hazard_cycle - classify the control signals just set by
+ * do_stall_check, as in CS:APP 4.5.8.  Every bubble inserted into D or E
+ * becomes a cycle with no instruction leaving W, so bubbles measure the
+ * cycles lost
+ */
+static void hazard_cycle()
+{
+    /* pipe-pred squashes the wrong path of a mispredicted ret, in M,
+       with a bubble into M as well.  Exceptions also bubble M, but
+       then end the run */
+    bool_t ret_squash = ex_mem_state->op == P_BUBBLE &&
+	ex_mem_curr->icode == I_RET && mem_wb_next->status == STAT_AOK &&
+	(mem_wb_curr->status == STAT_AOK || mem_wb_curr->status == STAT_BUB);
+    /* A bubble into E or M that only passes on one from the stage
+       before it loses no cycle */
+    int bubbles = (if_id_state->op == P_BUBBLE) +
+	(id_ex_state->op == P_BUBBLE && if_id_curr->status != STAT_BUB) +
+	(ret_squash && id_ex_curr->status != STAT_BUB);
+    int stalls = (pc_state->op == P_STALL) + (if_id_state->op == P_STALL);
+    hazard_t h;
+    word_t pc;
+    byte_t icode, ifun;
+
+    /* A miss stalls the stages up to M, and W gets a bubble */
+    if (cache_stall == CS_DCACHE) {
+	hazard_add(H_DCACHE, ex_mem_curr->stage_pc,
+		   HPACK(ex_mem_curr->icode, ex_mem_curr->ifun), 1, 2);
+	return;
+    }
+    if (cache_stall == CS_ICACHE) {
+	hazard_add(H_ICACHE, f_pc, HPACK(if_id_next->icode, if_id_next->ifun),
+		   1, 1);
+	return;
+    }
+    if (!bubbles && !stalls)
+	return;
+    if (ret_squash) {
+	/* Mispredicted ret, now in M */
+	h = H_RET;
+	pc = ex_mem_curr->stage_pc;
+	icode = I_RET;
+	ifun = F_NONE;
+    } else if (if_id_state->op == P_STALL && id_ex_state->op == P_BUBBLE) {
+	/* Load/use: the load is in E */
+	h = H_LOAD_USE;
+	pc = id_ex_curr->stage_pc;
+	icode = id_ex_curr->icode;
+	ifun = id_ex_curr->ifun;
+    } else if (id_ex_curr->icode == I_JMP && id_ex_state->op == P_BUBBLE) {
+	/* Mispredicted branch, now in E */
+	h = H_MISPREDICT;
+	pc = id_ex_curr->stage_pc;
+	icode = id_ex_curr->icode;
+	ifun = id_ex_curr->ifun;
+    } else if (if_id_curr->icode == I_RET || id_ex_curr->icode == I_RET ||
+	       ex_mem_curr->icode == I_RET) {
+	/* ret in D, E or M */
+	h = H_RET;
+	if (if_id_curr->icode == I_RET) {
+	    pc = if_id_curr->stage_pc;
+	} else if (id_ex_curr->icode == I_RET) {
+	    pc = id_ex_curr->stage_pc;
+	} else {
+	    pc = ex_mem_curr->stage_pc;
+	}
+	icode = I_RET;
+	ifun = F_NONE;
+    } else {
+	/* Anything else is charged to the instruction in D */
+	h = H_OTHER;
+	pc = if_id_curr->stage_pc;
+	icode = if_id_curr->icode;
+	ifun = if_id_curr->ifun;
+    }
+    hazard_add(hazard_cause(h, icode), pc, HPACK(icode, ifun), bubbles,
+	       stalls);
+}
+
+static int by_lost(const void *a, const void *b)
+{
+    const hazard_pc_t *x = a, *y = b;
+    unsigned lx = 0, ly = 0;
+    int h;
+    for (h = 0; h < H_CAUSES; h++) {
+	lx += x->bubbles[h];
+	ly += y->bubbles[h];
+    }
+    if (lx != ly)
+	return lx < ly ? 1 : -1;
+    return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+#define HAZARD_TOP 10		/* Instructions listed in the report */
+
+/* Print the CPI breakdown and the instructions that lost the most cycles */
+static void hazard_report()
+{
+    hazard_pc_t *pcs = (hazard_pc_t *) malloc((hazard_count+1) * sizeof(hazard_pc_t));
+    double n = instructions > 0 ? instructions : 1;
+    int h, i, k, lost = 0;
+
+    printf("CPI breakdown:\n");
+    printf("  %-12s %5.2f\n", "base", instructions > 0 ? 1.0 : 0.0);
+    for (h = 0; h < H_CAUSES; h++) {
+	lost += hazard_bubbles[h];
+	if (hazard_events[h])
+	    printf("  %-12s %5.2f  %8u bubbles %8u stalls\n", hazard_names[h],
+		   hazard_bubbles[h] / n, hazard_bubbles[h], hazard_stalls[h]);
+    }
+    /* Bubbles are counted when inserted, so the last few may not have
+       reached W when the simulation stopped */
+    if (cycles - instructions > lost)
+	printf("  %-12s %5.2f  %8d cycles\n", "unattributed",
+	       (cycles - instructions - lost) / n, cycles - instructions - lost);
+    else if (cycles - instructions < lost)
+	printf("  (%d of the bubbles were still in the pipeline at the end)\n",
+	       lost - (cycles - instructions));
+
+    for (i = k = 0; i < hazard_size; i++)
+	if (hazard_pcs[i].used)
+	    pcs[k++] = hazard_pcs[i];
+    qsort(pcs, k, sizeof(hazard_pc_t), by_lost);
+    if (k > 0)
+	printf("Lost cycles by instruction:\n");
+    for (i = 0; i < k && i < HAZARD_TOP; i++) {
+	printf("  0x%.3x  %-8s", pcs[i].pc, iname(pcs[i].instr));
+	for (h = 0; h < H_CAUSES; h++)
+	    if (pcs[i].bubbles[h])
+		printf("  %s %u", hazard_names[h], pcs[i].bubbles[h]);
+	printf("  (%u stalls)\n", pcs[i].stalls);
+    }
+    free(pcs);
+}
+
+/*****************************************************************************
+ * branch prediction (-p)
+ *****************************************************************************/
+
+/* Only pipe-pred.hcl takes its predictions from here, through f_ptaken,
+   f_rasok and f_raspc.  Fetch looks the predictor up, and a call or ret
+   only moves the return address stack once D accepts it.  The counters
+   and the global history learn from the instructions that retire, so
+   the wrong path never trains them, while the RAS is not repaired after
+   a misprediction.  Accuracy is scored at retirement too, against the
+   address of the next instruction retired.  The other variants keep
+   their own policy, so bp_followed turns -p down for them */
+
+typedef enum { BP_TAKEN, BP_NT, BP_BTFNT, BP_BIMODAL, BP_GSHARE,
+	       BP_KINDS } bp_kind_t;
+
+static char *bp_names[BP_KINDS] = { "taken", "nt", "btfnt", "bimodal",
+				    "gshare" };
+
+#define BP_BITS 10		/* log2 of the counters, bits of history */
+#define BP_MASK ((1 << BP_BITS) - 1)
+#define RAS_SIZE 16		/* Deeper calls overwrite the oldest entry */
+#define JXX_LEN 5		/* Bytes of a jXX instruction */
+
+static bp_kind_t bp_kind = BP_TAKEN;
+static bool_t bp_ras = FALSE;
+static byte_t bp_count[1 << BP_BITS];	/* 2-bit saturating counters */
+static unsigned bp_ghr;			/* Global history, newest in bit 0 */
+static word_t ras[RAS_SIZE];
+static int ras_top, ras_depth;
+
+/* The last instruction retired, whose successor is not known yet */
+static bool_t bp_pending;
+static byte_t bp_icode, bp_ifun;
+static word_t bp_pc, bp_predpc;
+
+static unsigned bp_jxx, bp_jxx_ok, bp_ret, bp_ret_ok;
+
+/* spec is one of bp_names, optionally followed by "+ras" */
+static bool_t bp_parse(char *spec)
+{
+    char *plus = strchr(spec, '+');
+    size_t len = plus ? plus - spec : strlen(spec);
+    int k;
+
+    if (plus && strcmp(plus, "+ras") != 0)
+	return FALSE;
+    for (k = 0; k < BP_KINDS; k++)
+	if (strlen(bp_names[k]) == len && !strncmp(spec, bp_names[k], len)) {
+	    bp_kind = k;
+	    bp_ras = plus != NULL;
+	    return TRUE;
+	}
+    return FALSE;
+}
+
+static void bp_reset()
+{
+    memset(bp_count, 2, sizeof(bp_count));	/* Weakly taken */
+    bp_ghr = 0;
+    ras_top = ras_depth = 0;
+    bp_pending = FALSE;
+    bp_jxx = bp_jxx_ok = bp_ret = bp_ret_ok = 0;
+    f_ptaken = f_rasok = FALSE;
+    f_raspc = 0;
+}
+
+static byte_t *bp_counter(word_t pc)
+{
+    unsigned i = bp_kind == BP_GSHARE ? pc ^ bp_ghr : pc;
+    return &bp_count[i & BP_MASK];
+}
+
+/* Does f_predPC of this PIPE variant follow f_ptaken for a conditional
+   jump, and with +ras f_rasok and f_raspc for a ret?  Tried on a jump and
+   a ret made up in F, which is put back as it was */
+int gen_f_predPC();
+
+static bool_t bp_followed()
+{
+    if_id_ele saved = *if_id_next;
+    word_t saved_pc = f_pc;
+    bool_t jxx, ret;
+
+    f_pc = 0x200;
+    if_id_next->icode = I_JMP;
+    if_id_next->ifun = C_LE;
+    if_id_next->valc = 0x100;
+    if_id_next->valp = f_pc + JXX_LEN;
+    f_ptaken = TRUE;
+    jxx = gen_f_predPC() == 0x100;
+    f_ptaken = FALSE;
+    jxx = jxx && gen_f_predPC() == f_pc + JXX_LEN;
+
+    if_id_next->icode = I_RET;
+    if_id_next->ifun = F_NONE;
+    if_id_next->valp = f_pc + 1;
+    f_rasok = TRUE;
+    f_raspc = 0x300;
+    ret = gen_f_predPC() == 0x300;
+
+    *if_id_next = saved;
+    f_pc = saved_pc;
+    f_ptaken = f_rasok = FALSE;
+    return jxx && (ret || !bp_ras);
+}
+
+/* Predict the jXX or ret just fetched at f_pc */
+static void bp_fetch()
+{
+    if_id_ptr f = if_id_next;
+
+    if (f->icode == I_RET) {
+	f_rasok = bp_ras && ras_depth > 0;
+	f_raspc = ras[ras_top];
+	return;
+    }
+    if (f->ifun == C_YES) {
+	f_ptaken = TRUE;
+	return;
+    }
+    switch (bp_kind) {
+    case BP_TAKEN:
+	f_ptaken = TRUE;
+	break;
+    case BP_NT:
+	f_ptaken = FALSE;
+	break;
+    case BP_BTFNT:
+	f_ptaken = f->valc < f_pc;
+	break;
+    default:
+	f_ptaken = *bp_counter(f_pc) >= 2;
+	break;
+    }
+}
+
+static void bp_accept()
+{
+    if (!bp_ras || if_id_next->status != STAT_AOK)
+	return;
+    if (if_id_next->icode == I_CALL) {
+	ras_top = (ras_top + 1) % RAS_SIZE;
+	ras[ras_top] = if_id_next->valp;
+	if (ras_depth < RAS_SIZE)
+	    ras_depth++;
+    } else if (if_id_next->icode == I_RET && ras_depth > 0) {
+	ras_top = (ras_top + RAS_SIZE - 1) % RAS_SIZE;
+	ras_depth--;
+    }
+}
+
+/* Score the prediction made for the instruction retired before the one
+   in W, and train the counters with its outcome */
+static void bp_retire()
+{
+    word_t pc = mem_wb_curr->stage_pc;
+
+    if (bp_pending && bp_icode == I_JMP && bp_ifun != C_YES) {
+	bool_t taken = pc != bp_pc + JXX_LEN;
+	byte_t *c = bp_counter(bp_pc);
+	bp_jxx++;
+	bp_jxx_ok += bp_predpc == pc;
+	if (taken && *c < 3)
+	    (*c)++;
+	else if (!taken && *c > 0)
+	    (*c)--;
+	bp_ghr = ((bp_ghr << 1) | taken) & BP_MASK;
+    } else if (bp_pending && bp_icode == I_RET) {
+	bp_ret++;
+	bp_ret_ok += bp_predpc == pc;
+    }
+    bp_pending = TRUE;
+    bp_icode = mem_wb_curr->icode;
+    bp_ifun = mem_wb_curr->ifun;
+    bp_pc = pc;
+    bp_predpc = mem_wb_curr->predpc;
+}
+
+static void bp_report()
+{
+    printf("Branch prediction (%s%s):\n", bp_names[bp_kind],
+	   bp_ras ? "+ras" : "");
+    printf("  %-18s %8u predicted %8u correct %5.1f%%\n", "conditional jumps",
+	   bp_jxx, bp_jxx_ok, bp_jxx ? 100.0 * bp_jxx_ok / bp_jxx : 0.0);
+    printf("  %-18s %8u predicted %8u correct %5.1f%%\n", "returns",
+	   bp_ret, bp_ret_ok, bp_ret ? 100.0 * bp_ret_ok / bp_ret : 0.0);
+}
+
+/*****************************************************************************
+ * L1 caches (-I, -D, -m)
+ *****************************************************************************/
+
+/* Tags only, with LRU replacement and write-allocate as in csim: the
+   data always comes from mem.  Each block an access touches is looked
+   up, and a miss fills it at once, but the access only completes
+   miss_penalty cycles later for each block missed.  Meanwhile a fetch,
+   like a load or store, holds M and every stage before it and sends
+   bubbles into W, so that every miss costs its cycles in full.  The
+   write in M is held back until it leaves M, so that memory is written
+   once */
+
+typedef struct {
+    bool_t valid;
+    word_t tag;
+    unsigned used;		/* Time of the last access, for LRU */
+} cache_line_t;
+
+typedef struct {
+    char *name;
+    int s, E, b;
+    cache_line_t *lines;	/* 2^s sets of E lines */
+    unsigned clock;
+    unsigned hits, misses, evictions;
+} cache_t;
+
+static cache_t *icache = NULL, *dcache = NULL;
+
+/* Instruction or data access waiting for its block, and where */
+static int fetch_wait = 0, mem_wait = 0;
+static word_t fetch_wait_pc, mem_wait_pc;
+
+/* The cache described by spec ("s:E:b"), or NULL without one */
+static cache_t *new_cache(char *name, char *spec)
+{
+    cache_t *c;
+    int s, E, b;
+
+    if (!spec)
+	return NULL;
+    if (sscanf(spec, "%d:%d:%d", &s, &E, &b) != 3 || s < 0 || E < 1 ||
+	b < 0 || s + b > 30) {
+	fprintf(stderr, "Invalid %s parameters '%s', expected s:E:b\n",
+		name, spec);
+	exit(1);
+    }
+    c = (cache_t *) calloc(1, sizeof(cache_t));
+    c->name = name;
+    c->s = s;
+    c->E = E;
+    c->b = b;
+    c->lines = (cache_line_t *) calloc((size_t) E << s, sizeof(cache_line_t));
+    return c;
+}
+
+static void cache_reset()
+{
+    cache_t *c;
+    int i;
+
+    if (!icache && !dcache) {
+	icache = new_cache("I-cache", icache_spec);
+	dcache = new_cache("D-cache", dcache_spec);
+    }
+    for (i = 0; i < 2; i++) {
+	c = i ? dcache : icache;
+	if (!c)
+	    continue;
+	memset(c->lines, 0, (sizeof(cache_line_t) * c->E) << c->s);
+	c->clock = c->hits = c->misses = c->evictions = 0;
+    }
+    fetch_wait = mem_wait = 0;
+    cache_stall = CS_NONE;
+}
+
+/* Look up the block holding addr, filling it on a miss */
+static bool_t cache_block(cache_t *c, word_t addr)
+{
+    word_t tag = addr >> (c->s + c->b);
+    cache_line_t *set = c->lines + ((addr >> c->b) & ((1 << c->s) - 1)) * c->E;
+    cache_line_t *victim = set;
+    int j;
+
+    c->clock++;
+    for (j = 0; j < c->E; j++) {
+	if (set[j].valid && set[j].tag == tag) {
+	    set[j].used = c->clock;
+	    c->hits++;
+	    return TRUE;
+	}
+	if (!set[j].valid || (victim->valid && set[j].used < victim->used))
+	    victim = &set[j];
+    }
+    c->misses++;
+    c->evictions += victim->valid;
+    victim->valid = TRUE;
+    victim->tag = tag;
+    victim->used = c->clock;
+    return FALSE;
+}
+
+/* Access len bytes at addr.  How many of their blocks miss? */
+static int cache_access(cache_t *c, word_t addr, int len)
+{
+    word_t block, last = (addr + len - 1) >> c->b;
+    int missed = 0;
+
+    for (block = addr >> c->b; block <= last; block++)
+	missed += !cache_block(c, block << c->b);
+    return missed;
+}
+
+/* Will an instruction with this status end the run when it gets to W? */
+static bool_t ending(stat_t status)
+{
+    return status != STAT_AOK && status != STAT_BUB;
+}
+
+/*
+ * cache_cycle - once do_stall_check has set the control for the next
+ * clock, hold the pipeline while an access that missed waits, for the
+ * penalty times the blocks missed.  A miss that has waited long enough
+ * completes without another lookup.
+ */
+static void cache_cycle()
+{
+    /* An access in M that fetch held up has been looked up already */
+    bool_t held = cache_stall == CS_ICACHE;
+    int missed;
+
+    cache_stall = CS_NONE;
+
+    /* The load or store in M, unless an exception is under way */
+    if (dcache && (mem_read || mem_write) && ex_mem_curr->status == STAT_AOK
+	&& !dmem_error && mem_wb_state->op == P_LOAD && !held) {
+	if (mem_wait > 0 && mem_wait_pc == ex_mem_curr->stage_pc)
+	    mem_wait--;
+	else if ((missed = cache_access(dcache, mem_addr, sizeof(word_t))) > 0) {
+	    mem_wait = missed * miss_penalty;
+	    mem_wait_pc = ex_mem_curr->stage_pc;
+	} else
+	    mem_wait = 0;
+	if (mem_wait > 0) {
+	    pc_state->op = P_STALL;
+	    if_id_state->op = P_STALL;
+	    id_ex_state->op = P_STALL;
+	    ex_mem_state->op = P_STALL;
+	    mem_wb_state->op = P_BUBBLE;
+	    mem_write = FALSE;
+	    cache_stall = CS_DCACHE;
+	    return;
+	}
+    }
+
+    /* The fetch, if D takes it and no halt or exception ahead of it is
+       about to end the run */
+    if (icache && !imem_error && if_id_state->op == P_LOAD &&
+	pc_state->op == P_LOAD && !ending(if_id_curr->status) &&
+	!ending(id_ex_curr->status) && !ending(ex_mem_curr->status) &&
+	!ending(mem_wb_curr->status)) {
+	if (fetch_wait > 0 && fetch_wait_pc == f_pc)
+	    fetch_wait--;
+	else if ((missed = cache_access(icache, f_pc,
+					if_id_next->valp - f_pc)) > 0) {
+	    fetch_wait = missed * miss_penalty;
+	    fetch_wait_pc = f_pc;
+	} else
+	    fetch_wait = 0;
+	if (fetch_wait > 0) {
+	    /* The instruction in W leaves, so fetch again from f_pc itself,
+	       which may have come from it */
+	    pc_next->pc = f_pc;
+	    pc_next->status = STAT_AOK;
+	    if_id_state->op = P_STALL;
+	    id_ex_state->op = P_STALL;
+	    ex_mem_state->op = P_STALL;
+	    mem_wb_state->op = P_BUBBLE;
+	    mem_write = FALSE;
+	    cache_stall = CS_ICACHE;
+	}
+    }
+}
+
+/* Print the hit rates of the caches */
+static void cache_report()
+{
+    cache_t *c;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+	c = i ? dcache : icache;
+	if (!c)
+	    continue;
+	printf("L1 %s (S=%d, E=%d, B=%d): %u hits, %u misses, %u evictions,"
+	       " hit rate %.1f%%\n", c->name, 1 << c->s, c->E, 1 << c->b,
+	       c->hits, c->misses, c->evictions,
+	       c->hits + c->misses ? 100.0 * c->hits / (c->hits + c->misses)
+	       : 0.0);
+    }
+}
+
+/*****************************************************************************
+ * binary cycle trace (-T), see ptrace.h
+ *****************************************************************************/
+
+#define TRACE_BUF 4096		/* Records buffered before each write */
+
+static FILE *trace_file = NULL;
+static ptrace_rec_t trace_buf[TRACE_BUF];
+static int trace_count = 0;
+
+static void trace_open()
+{
+    ptrace_hdr_t hdr;
+
+    if (!trace_filename)
+	return;
+    trace_file = fopen(trace_filename, "wb");
+    if (!trace_file) {
+	fprintf(stderr, "Couldn't open trace file %s\n", trace_filename);
+	exit(1);
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PTRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = PTRACE_VERSION;
+    hdr.rec_size = sizeof(ptrace_rec_t);
+    snprintf(hdr.simname, sizeof(hdr.simname), "%s", simname);
+    fwrite(&hdr, sizeof(hdr), 1, trace_file);
+}
+
+static void trace_flush()
+{
+    if (fwrite(trace_buf, sizeof(ptrace_rec_t), trace_count, trace_file)
+	!= trace_count) {
+	fprintf(stderr, "Couldn't write trace file %s\n", trace_filename);
+	exit(1);
+    }
+    trace_count = 0;
+}
+
+static void trace_close()
+{
+    if (!trace_file)
+	return;
+    trace_flush();
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+/* Where decode took val (for register src) from.  Forwarding sources are
+   tried in the priority order of pipe-std.hcl, and only count when they
+   hold the value that was chosen */
+static unsigned char fwd_source(byte_t src, word_t val, bool_t is_a)
+{
+    if (is_a && (if_id_curr->icode == I_CALL || if_id_curr->icode == I_JMP)
+	&& val == if_id_curr->valp)
+	return FWD_VALP;
+    if (src == REG_NONE)
+	return FWD_NONE;
+    if (src == ex_mem_next->deste && val == ex_mem_next->vale)
+	return FWD_E_VALE;
+    if (src == mem_wb_next->destm && val == mem_wb_next->valm)
+	return FWD_M_VALM;
+    if (src == ex_mem_curr->deste && val == ex_mem_curr->vale)
+	return FWD_M_VALE;
+    if (src == mem_wb_curr->destm && val == mem_wb_curr->valm)
+	return FWD_W_VALM;
+    if (src == mem_wb_curr->deste && val == mem_wb_curr->vale)
+	return FWD_W_VALE;
+    return FWD_REG;
+}
+
+/* Record the stages of cycle cyc, once its control signals are known */
+static void trace_cycle(int cyc)
+{
+    ptrace_rec_t *r = &trace_buf[trace_count];
+
+    r->cycle = cyc;
+    r->pc[T_F] = f_pc;
+    r->instr[T_F] = HPACK(if_id_next->icode, if_id_next->ifun);
+    r->status[T_F] = if_id_next->status;
+    r->op[T_F] = pc_state->op;
+    r->pc[T_D] = if_id_curr->stage_pc;
+    r->instr[T_D] = HPACK(if_id_curr->icode, if_id_curr->ifun);
+    r->status[T_D] = if_id_curr->status;
+    r->op[T_D] = if_id_state->op;
+    r->pc[T_E] = id_ex_curr->stage_pc;
+    r->instr[T_E] = HPACK(id_ex_curr->icode, id_ex_curr->ifun);
+    r->status[T_E] = id_ex_curr->status;
+    r->op[T_E] = id_ex_state->op;
+    r->pc[T_M] = ex_mem_curr->stage_pc;
+    r->instr[T_M] = HPACK(ex_mem_curr->icode, ex_mem_curr->ifun);
+    r->status[T_M] = ex_mem_curr->status;
+    r->op[T_M] = ex_mem_state->op;
+    r->pc[T_W] = mem_wb_curr->stage_pc;
+    r->instr[T_W] = HPACK(mem_wb_curr->icode, mem_wb_curr->ifun);
+    r->status[T_W] = mem_wb_curr->status;
+    r->op[T_W] = mem_wb_state->op;
+    r->fwd_a = fwd_source(id_ex_next->srca, id_ex_next->vala, TRUE);
+    r->fwd_b = fwd_source(id_ex_next->srcb, id_ex_next->valb, FALSE);
+    r->cc = cc;
+    r->pad[0] = r->pad[1] = 0;
+    if (++trace_count == TRACE_BUF)
+	trace_flush();
+}
+
+/*****************************************************************************
+ * lockstep check against the ISA (-t)
+ *****************************************************************************/
+
+/*
+ * cosim_retire_wb - step the ISA past the instruction in W, whose
+ * results update_state has just written, and compare.  The first half
+ * of a split popl (pipe-1w) leaves its destination to the I_POP2 behind
+ * it, which retires nothing of its own.
+ */
+static bool_t cosim_retire_wb()
+{
+    reg_id_t pending = REG_NONE;
+
+    if (mem_wb_curr->status == STAT_BUB || mem_wb_curr->icode == I_POP2)
+	return TRUE;
+    if (mem_wb_curr->icode == I_POPL) {
+	if (mem_wb_next->icode == I_POP2 && mem_wb_next->status != STAT_BUB
+	    && mem_wb_next->stage_pc == mem_wb_curr->stage_pc)
+	    pending = mem_wb_next->destm;
+	else if (ex_mem_next->icode == I_POP2
+		 && ex_mem_next->status != STAT_BUB
+		 && ex_mem_next->stage_pc == mem_wb_curr->stage_pc)
+	    pending = ex_mem_next->destm;
+    }
+    return cosim_retire(cosim, mem_wb_curr->stage_pc, mem_wb_curr->status,
+			reg, pending);
+}
+
+static void print_stage(char *name, word_t pc, byte_t icode, byte_t ifun,
+			byte_t stat)
+{
+    if (stat == STAT_BUB)
+	printf("%s: bubble\n", name);
+    else
+	printf("%s: 0x%03x %-7s Stat = %s\n", name, pc,
+	       iname(HPACK(icode, ifun)), stat_name(stat));
+}
+
+static void print_pipe()
+{
+    printf("Pipeline after cycle %d:\n", cycles);
+    printf("F: predPC = 0x%x\n", pc_curr->pc);
+    print_stage("D", if_id_curr->stage_pc, if_id_curr->icode,
+		if_id_curr->ifun, if_id_curr->status);
+    print_stage("E", id_ex_curr->stage_pc, id_ex_curr->icode,
+		id_ex_curr->ifun, id_ex_curr->status);
+    print_stage("M", ex_mem_curr->stage_pc, ex_mem_curr->icode,
+		ex_mem_curr->ifun, ex_mem_curr->status);
+    print_stage("W", mem_wb_curr->stage_pc, mem_wb_curr->icode,
+		mem_wb_curr->ifun, mem_wb_curr->status);
+}
+
 /* Run pipeline for one cycle */
 /* Return status of processor */
 /* Max_instr indicates maximum number of instructions that
@@ -688,16 +1582,22 @@ static byte_t sim_step_pipe(int max_instr, int ccount)
     byte_t wb_status = mem_wb_curr->status;
     byte_t mem_status = mem_wb_next->status;
     /* How many instructions are ahead of one in wb / ex? */
-    int ahead_mem = (wb_status != STAT_BUB);
-    int ahead_ex = ahead_mem + (mem_status != STAT_BUB);
+    int ahead_mem = (wb_status != STAT_BUB && mem_wb_curr->icode != I_POP2);
+    int ahead_ex = ahead_mem +
+	(mem_status != STAT_BUB && mem_wb_next->icode != I_POP2);
     bool_t update_mem = ahead_mem < max_instr;
     bool_t update_cc = ahead_ex < max_instr;
 
     /* Update program-visible state */
     update_state(update_mem, update_cc);
+    /* With -t, stop right at the first divergence from the ISA */
+    if (cosim && !cosim_retire_wb() && do_check)
+	return status;
     /* Update pipe registers */
     update_pipes();
+#ifndef PSIM_BATCH
     tty_report(ccount);
+#endif
     if (pc_state->op == P_ERROR)
 	pc_curr->status = STAT_PIP;
     if (if_id_state->op == P_ERROR)
@@ -718,6 +1618,14 @@ static byte_t sim_step_pipe(int max_instr, int ccount)
     do_id_wb_stages();
 
     do_stall_check();
+    if (icache || dcache)
+	cache_cycle();
+    if (if_id_state->op == P_LOAD)
+	bp_accept();
+    if (trace_file)
+	trace_cycle(ccount);
+    if (hazard_stats)
+	hazard_cycle();
 #if 0
     /* This doesn't seem necessary */
     if (id_ex_curr->status != STAT_AOK
@@ -729,12 +1637,24 @@ static byte_t sim_step_pipe(int max_instr, int ccount)
 
     /* Performance monitoring */
     if (mem_wb_curr->status != STAT_BUB && mem_wb_curr->icode != I_POP2) {
+	/* A miss that held up the first instruction costs cycles too */
+	if (starting_up && fill_cycles > PIPE_FILL)
+	    cycles += fill_cycles - PIPE_FILL;
 	starting_up = 0;
 	instructions++;
 	cycles++;
+	if (predictor)
+	    bp_retire();
     } else {
 	if (!starting_up)
 	    cycles++;
+	else
+	    fill_cycles++;
+	/* The second half of a split popl takes a cycle of its own */
+	if (hazard_stats && mem_wb_curr->icode == I_POP2 &&
+	    mem_wb_curr->status != STAT_BUB)
+	    hazard_add(H_POP2, mem_wb_curr->stage_pc,
+		       HPACK(I_POP2, F_NONE), 1, 0);
     }
     
     sim_report();
@@ -757,11 +1677,23 @@ int sim_run_pipe(int max_instr, int max_cycle, byte_t *statusp, cc_t *ccp)
     int ccount = 0;
     byte_t run_status = STAT_AOK;
     while (icount < max_instr && ccount < max_cycle) {
+	/* Count instructions as the ISA does, when the one in W retires.
+	   The bubbles in W, including those of a cache stall, and the
+	   second half of a split popl do not count toward max_instr */
+	bool_t retiring = mem_wb_curr->status != STAT_BUB &&
+	    mem_wb_curr->icode != I_POP2;
         run_status = sim_step_pipe(max_instr-icount, ccount);
-	if (run_status != STAT_BUB)
+	if (cosim && cosim->failed && do_check)
+	    break;
+	if (retiring)
+	    icount++;
+	if (run_status != STAT_AOK && run_status != STAT_BUB) {
+	    /* The instruction in W stops the processor without an update */
+	    if (cosim)
+		cosim_retire_wb();
 	    icount++;
-	if (run_status != STAT_AOK && run_status != STAT_BUB)
 	    break;
+	}
 	ccount++;
     }
     if (statusp)
@@ -771,12 +1703,53 @@ int sim_run_pipe(int max_instr, int max_cycle, byte_t *statusp, cc_t *ccp)
     return icount;
 }
 
+#ifdef PSIM_LIB
+/*
+ * sim_run_file - entry point of psim built as a shared library (see
+ * pdriver.c).  Loads object file fname into a fresh processor and runs
+ * it as "psim -v 0 -t" would.  Returns the final status, or -1 if the
+ * file cannot be loaded, and sets *eaxp, *cyclesp and *instrp.  The
+ * first divergence from the ISA, if any, goes into diverged (128 bytes),
+ * and the empty string otherwise
+ */
+int sim_run_file(char *fname, int *eaxp, int *cyclesp, int *instrp,
+		 char *diverged)
+{
+    FILE *f = fopen(fname, "r");
+    byte_t run_status = STAT_AOK;
+
+    if (!f)
+	return -1;
+    if (!initialized)
+	sim_init();
+    else {
+	sim_reset();
+	clear_mem(mem);
+    }
+    if (load_mem(mem, f, 1) == 0) {
+	fclose(f);
+	return -1;
+    }
+    fclose(f);
+    if (cosim)
+	free_cosim(cosim);
+    cosim = new_cosim(mem, reg, cc, NULL);
+    sim_run_pipe(instr_limit, 5*instr_limit, &run_status, NULL);
+    *eaxp = get_reg_val(reg, REG_EAX);
+    *cyclesp = cycles;
+    *instrp = instructions;
+    strcpy(diverged, cosim->failed ? cosim->msg : "");
+    return run_status;
+}
+#endif /* PSIM_LIB */
+
 /* If dumpfile set nonNULL, lots of status info printed out */
 void sim_set_dumpfile(FILE *df)
 {
     dumpfile = df;
 }
 
+#ifndef PSIM_BATCH
 /*
  * sim_log dumps a formatted string to the dumpfile, if it exists
  * accepts variable argument list
@@ -789,6 +1762,7 @@ void sim_log( const char *format, ... ) {
 	va_end( arg );
     }
 }
+#endif /* PSIM_BATCH */
 
 
 /*************************************************************
@@ -1246,6 +2220,7 @@ int Tcl_AppInit(Tcl_Interp *interp)
  ******************************************************************************/
 
 #define MAX_STAGE 10
+#define PIPE_STORE 1024	/* Bytes for the state of all pipe registers */
 
 /******************************************************************************
  *	static variables
@@ -1254,17 +2229,38 @@ int Tcl_AppInit(Tcl_Interp *interp)
 static pipe_ptr pipes[MAX_STAGE];
 static int pipe_count = 0;
 
+/* The pipe registers and their current and next states, side by side
+   so that the whole pipeline shares a few cache lines */
+static pipe_ele pipe_tab[MAX_STAGE];
+static union {
+    double align;
+    char bytes[PIPE_STORE];
+} pipe_store;
+static int pipe_store_used = 0;
+
 /******************************************************************************
  *	function definitions
  ******************************************************************************/
 
+/* Space for count bytes of pipe register state */
+static void *pipe_alloc(int count)
+{
+  int size = (count + sizeof(double) - 1) & ~(sizeof(double) - 1);
+  void *result;
+  if (pipe_store_used + size > PIPE_STORE)
+    return malloc(count);
+  result = pipe_store.bytes + pipe_store_used;
+  pipe_store_used += size;
+  return result;
+}
+
 /* Create new pipe with count bytes of state */
 /* bubble_val indicates state corresponding to pipeline bubble */
 pipe_ptr new_pipe(int count, void *bubble_val)
 {
-  pipe_ptr result = (pipe_ptr) malloc(sizeof(pipe_ele));
-  result->current = malloc(count);
-  result->next = malloc(count);
+  pipe_ptr result = &pipe_tab[pipe_count];
+  result->current = pipe_alloc(count);
+  result->next = pipe_alloc(count);
   memcpy(result->current, bubble_val, count);
   memcpy(result->next, bubble_val, count);
   result->count = count;
@@ -1428,11 +2424,14 @@ void do_if_stage()
     if_id_next->valp = valp;
     if_id_next->valc = valc;
 
+    if (if_id_next->icode == I_JMP || if_id_next->icode == I_RET)
+	bp_fetch();
     pc_next->pc = gen_f_predPC();
 
     pc_next->status = (if_id_next->status == STAT_AOK) ? STAT_AOK : STAT_BUB;
 
     if_id_next->stage_pc = f_pc;
+    if_id_next->predpc = pc_next->pc;
 }
 
 int gen_d_srcA();
@@ -1476,6 +2475,7 @@ void do_id_wb_stages()
     id_ex_next->ifun = if_id_curr->ifun;
     id_ex_next->valc = if_id_curr->valc;
     id_ex_next->stage_pc = if_id_curr->stage_pc;
+    id_ex_next->predpc = if_id_curr->predpc;
     id_ex_next->status = if_id_curr->status;
 }
 
@@ -1525,6 +2525,7 @@ void do_ex_stage()
     ex_mem_next->srca = id_ex_curr->srca;
     ex_mem_next->status = id_ex_curr->status;
     ex_mem_next->stage_pc = id_ex_curr->stage_pc;
+    ex_mem_next->predpc = id_ex_curr->predpc;
 }
 
 /* Functions defined using HCL */
@@ -1535,16 +2536,15 @@ int gen_m_stat();
 
 void do_mem_stage()
 {
-    bool_t read = gen_mem_read();
-
     word_t valm = 0;
 
     mem_addr = gen_mem_addr();
     mem_data = ex_mem_curr->vala;
+    mem_read = gen_mem_read();
     mem_write = gen_mem_write();
     dmem_error = FALSE;
 
-    if (read) {
+    if (mem_read) {
 	dmem_error = dmem_error || !get_word_val(mem, mem_addr, &valm);
 	if (!dmem_error)
 	  sim_log("\tMemory: Read 0x%x from 0x%x\n",
@@ -1566,6 +2566,7 @@ void do_mem_stage()
     mem_wb_next->destm = ex_mem_curr->destm;
     mem_wb_next->status = gen_m_stat();
     mem_wb_next->stage_pc = ex_mem_curr->stage_pc;
+    mem_wb_next->predpc = ex_mem_curr->predpc;
 }
 
 /* Set stalling conditions for different stages */
@@ -1590,6 +2591,26 @@ p_stat_t pipe_cntl(char *name, int stall, int bubble)
     }
 }
 
+#ifdef HCL_FUSED
+/* hcl2c -O computes all the control signals at once, sharing their
+   common terms */
+void compute_control();
+extern int ctl_F_stall, ctl_F_bubble;
+extern int ctl_D_stall, ctl_D_bubble;
+extern int ctl_E_stall, ctl_E_bubble;
+extern int ctl_M_stall, ctl_M_bubble;
+extern int ctl_W_stall, ctl_W_bubble;
+
+void do_stall_check()
+{
+    compute_control();
+    pc_state->op = pipe_cntl("PC", ctl_F_stall, ctl_F_bubble);
+    if_id_state->op = pipe_cntl("ID", ctl_D_stall, ctl_D_bubble);
+    id_ex_state->op = pipe_cntl("EX", ctl_E_stall, ctl_E_bubble);
+    ex_mem_state->op = pipe_cntl("MEM", ctl_M_stall, ctl_M_bubble);
+    mem_wb_state->op = pipe_cntl("WB", ctl_W_stall, ctl_W_bubble);
+}
+#else
 void do_stall_check()
 {
     pc_state->op = pipe_cntl("PC", gen_F_stall(), gen_F_bubble());
@@ -1598,6 +2619,7 @@ void do_stall_check()
     ex_mem_state->op = pipe_cntl("MEM", gen_M_stall(), gen_M_bubble());
     mem_wb_state->op = pipe_cntl("WB", gen_W_stall(), gen_W_bubble());
 }
+#endif
 
 
 
@@ -0,0 +1,244 @@
+/***********************************************************************
+ * ptrace.c - Reader for the binary cycle traces of psim (-T)
+ *
+ * Prints hazard statistics for a whole trace, or renders a window of
+ * cycles as a pipeline diagram.
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "isa.h"
+#include "pipeline.h"
+#include "ptrace.h"
+
+#define NFWD (FWD_W_VALE + 1)
+
+static char *stage_names[T_STAGES] = { "F", "D", "E", "M", "W" };
+static char *fwd_names[NFWD] = { "none", "reg", "valP", "e_valE",
+				 "m_valM", "M_valE", "W_valM", "W_valE" };
+
+/* Selection of the cycles to render */
+static unsigned first = 0, last = ~0u;
+static int events_only = 0;	/* Only cycles with a stall or bubble */
+static int pc_filter = 0;	/* Only cycles with pc_value in a stage */
+static unsigned pc_value;
+
+/* Statistics over the whole trace */
+typedef struct {
+    int started;		/* Has an instruction left W yet? */
+    unsigned fill;		/* Cycles before that */
+    unsigned cycles;
+    unsigned instructions;	/* Leaving W */
+    unsigned stalls[T_STAGES];
+    unsigned bubbles[T_STAGES];
+    unsigned errors[T_STAGES];
+    unsigned load_use;		/* D stalled, bubble into E */
+    unsigned mispredict;	/* Bubbles into D and E */
+    unsigned ret;		/* F stalled, bubble into D */
+    unsigned fwd_a[NFWD];
+    unsigned fwd_b[NFWD];
+} stats_t;
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-h] [-w first:last] [-e] [-p pc] file.trace\n", name);
+    printf("Without -w, -e or -p, print the hazard statistics of the trace\n");
+    printf("   -h     Print this message\n");
+    printf("   -w a:b Render cycles a to b (either may be omitted)\n");
+    printf("   -e     Render only cycles with a stall or a bubble\n");
+    printf("   -p pc  Render only cycles with the instruction at pc in a stage\n");
+    exit(0);
+}
+
+static void add_stats(stats_t *s, ptrace_rec_t *r)
+{
+    int i;
+
+    /* As in psim, filling the pipeline only counts for the cycles a
+       cache miss added to it */
+    if (!s->started) {
+	if (r->status[T_W] == STAT_BUB) {
+	    s->fill++;
+	    return;
+	}
+	s->started = 1;
+	if (s->fill > PIPE_FILL)
+	    s->cycles += s->fill - PIPE_FILL;
+    }
+    s->cycles++;
+    /* The second half of a split popl is not an instruction of its own */
+    if (r->status[T_W] != STAT_BUB && HI4(r->instr[T_W]) != I_POP2)
+	s->instructions++;
+    for (i = 0; i < T_STAGES; i++) {
+	s->stalls[i] += r->op[i] == P_STALL;
+	s->bubbles[i] += r->op[i] == P_BUBBLE;
+	s->errors[i] += r->op[i] == P_ERROR;
+    }
+    /* Classify the hazards as in CS:APP 4.5.8, by the control they cause */
+    if (r->op[T_D] == P_STALL && r->op[T_E] == P_BUBBLE)
+	s->load_use++;
+    else if (r->op[T_D] == P_BUBBLE && r->op[T_E] == P_BUBBLE)
+	s->mispredict++;
+    else if (r->op[T_F] == P_STALL && r->op[T_D] == P_BUBBLE)
+	s->ret++;
+    if (r->fwd_a < NFWD)
+	s->fwd_a[r->fwd_a]++;
+    if (r->fwd_b < NFWD)
+	s->fwd_b[r->fwd_b]++;
+}
+
+static double percent(unsigned n, unsigned total)
+{
+    return total ? 100.0 * n / total : 0;
+}
+
+static void print_stats(stats_t *s)
+{
+    int i;
+
+    printf("%u cycles, %u instructions, CPI %.2f\n", s->cycles,
+	   s->instructions,
+	   s->instructions ? (double) s->cycles / s->instructions : 0.0);
+    printf("\nStage     stalls   bubbles    errors\n");
+    for (i = 0; i < T_STAGES; i++)
+	printf("%-5s  %9u %9u %9u\n", stage_names[i], s->stalls[i],
+	       s->bubbles[i], s->errors[i]);
+    printf("\nHazard               cycles\n");
+    printf("load/use          %9u  %5.1f%%\n", s->load_use,
+	   percent(s->load_use, s->cycles));
+    printf("mispredict        %9u  %5.1f%%\n", s->mispredict,
+	   percent(s->mispredict, s->cycles));
+    printf("ret               %9u  %5.1f%%\n", s->ret,
+	   percent(s->ret, s->cycles));
+    printf("\nSource          valA      valB\n");
+    for (i = 0; i < NFWD; i++)
+	printf("%-8s   %9u %9u\n", fwd_names[i], s->fwd_a[i], s->fwd_b[i]);
+}
+
+/* Should cycle r be rendered? */
+static int selected(ptrace_rec_t *r)
+{
+    int i, hit;
+
+    if (r->cycle < first || r->cycle > last)
+	return 0;
+    if (events_only) {
+	for (i = hit = 0; i < T_STAGES; i++)
+	    hit |= r->op[i] != P_LOAD;
+	if (!hit)
+	    return 0;
+    }
+    if (pc_filter) {
+	for (i = hit = 0; i < T_STAGES; i++)
+	    hit |= r->status[i] != STAT_BUB && r->pc[i] == pc_value;
+	if (!hit)
+	    return 0;
+    }
+    return 1;
+}
+
+static void print_header()
+{
+    int i;
+    printf("%-8s", "cycle");
+    for (i = 0; i < T_STAGES; i++)
+	printf(" %-17s", stage_names[i]);
+    printf(" valA   valB\n");
+}
+
+/* One line per cycle: each stage as "pc instr", followed by the control
+   applied at the next clock (S = stall, B = bubble, E = error) */
+static void render(ptrace_rec_t *r)
+{
+    static char marks[] = " SBE";
+    char cell[32];
+    int i;
+
+    printf("%-8u", r->cycle);
+    for (i = 0; i < T_STAGES; i++) {
+	if (r->status[i] == STAT_BUB)
+	    snprintf(cell, sizeof(cell), "bubble");
+	else
+	    snprintf(cell, sizeof(cell), "0x%03x %s", r->pc[i],
+		     iname(r->instr[i]));
+	printf(" %-15s %c", cell, r->op[i] <= P_ERROR ? marks[r->op[i]] : '?');
+    }
+    printf(" %-6s %s\n", r->fwd_a < NFWD ? fwd_names[r->fwd_a] : "?",
+	   r->fwd_b < NFWD ? fwd_names[r->fwd_b] : "?");
+}
+
+int main(int argc, char *argv[])
+{
+    ptrace_hdr_t hdr;
+    ptrace_rec_t buf[4096];
+    stats_t stats;
+    FILE *f;
+    size_t n, i;
+    int c, show = 0;
+    char *colon;
+
+    while ((c = getopt(argc, argv, "hw:ep:")) != -1) {
+	switch(c) {
+	case 'w':
+	    show = 1;
+	    colon = strchr(optarg, ':');
+	    if (*optarg != ':')
+		first = strtoul(optarg, NULL, 0);
+	    if (!colon)
+		last = first;
+	    else if (colon[1])
+		last = strtoul(colon+1, NULL, 0);
+	    break;
+	case 'e':
+	    show = events_only = 1;
+	    break;
+	case 'p':
+	    show = pc_filter = 1;
+	    pc_value = strtoul(optarg, NULL, 0);
+	    break;
+	case 'h':
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind != argc - 1)
+	usage(argv[0]);
+
+    f = fopen(argv[optind], "rb");
+    if (!f) {
+	fprintf(stderr, "Couldn't open trace file %s\n", argv[optind]);
+	exit(1);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	memcmp(hdr.magic, PTRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+	hdr.version != PTRACE_VERSION || hdr.rec_size != sizeof(ptrace_rec_t)) {
+	fprintf(stderr, "%s: not a version %d psim trace\n", argv[optind],
+		PTRACE_VERSION);
+	exit(1);
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    if (show) {
+	printf("%.*s\n", (int) sizeof(hdr.simname), hdr.simname);
+	print_header();
+    }
+    while ((n = fread(buf, sizeof(ptrace_rec_t), 4096, f)) > 0) {
+	for (i = 0; i < n; i++) {
+	    if (!show)
+		add_stats(&stats, &buf[i]);
+	    else if (selected(&buf[i]))
+		render(&buf[i]);
+	}
+	if (show && buf[n-1].cycle > last)
+	    break;
+    }
+    fclose(f);
+    if (!show) {
+	printf("%.*s\n", (int) sizeof(hdr.simname), hdr.simname);
+	print_stats(&stats);
+    }
+    return 0;
+}
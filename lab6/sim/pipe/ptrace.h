@@ -0,0 +1,40 @@
+/*
+ * ptrace.h - Binary per-cycle trace of PIPE (psim -T), read by ptrace
+ *
+ * A trace is a ptrace_hdr_t followed by one ptrace_rec_t per simulated
+ * cycle, all in host byte order.
+ */
+
+#ifndef PTRACE_H
+#define PTRACE_H
+
+#define PTRACE_MAGIC "Y86T"
+#define PTRACE_VERSION 1
+
+/* Stages, in the order of the arrays of a record */
+typedef enum { T_F, T_D, T_E, T_M, T_W, T_STAGES } trace_stage_t;
+
+/* Where decode took valA / valB from */
+typedef enum { FWD_NONE, FWD_REG, FWD_VALP, FWD_E_VALE, FWD_M_VALM,
+	       FWD_M_VALE, FWD_W_VALM, FWD_W_VALE } fwd_source_t;
+
+typedef struct {
+    char magic[4];
+    unsigned version;
+    unsigned rec_size;		/* sizeof(ptrace_rec_t) */
+    char simname[52];
+} ptrace_hdr_t;
+
+typedef struct {
+    unsigned cycle;
+    unsigned pc[T_STAGES];	/* F: address fetched, others: stage_pc */
+    unsigned char instr[T_STAGES];	/* icode:ifun, F: as fetched */
+    unsigned char status[T_STAGES];	/* stat_t of the stage */
+    unsigned char op[T_STAGES];	/* Control for the next update (p_stat_t) */
+    unsigned char fwd_a;	/* Source of d_valA (fwd_source_t) */
+    unsigned char fwd_b;	/* Source of d_valB */
+    unsigned char cc;		/* Condition codes */
+    unsigned char pad[2];
+} ptrace_rec_t;
+
+#endif /* PTRACE_H */
@@ -43,7 +43,7 @@ extern stat_t stat;
 extern mux_source_t amux, bmux;
 
 /* Provide global access to current states of all pipeline registers */
-pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
+extern pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
 
 /* Current States */
 extern pc_ptr pc_curr;
@@ -83,6 +83,11 @@ extern word_t e_valb;
 extern bool_t e_bcond;
 extern bool_t dmem_error;
 
+/* Dynamic prediction for the fetched instruction (-p, pipe-pred.hcl) */
+extern bool_t f_ptaken;         /* Predict the jXX taken? */
+extern bool_t f_rasok;          /* Does the RAS hold a return address? */
+extern word_t f_raspc;          /* The address on top of the RAS */
+
 /* Simulator operating mode */
 extern sim_mode_t sim_mode;
 /* Log file */
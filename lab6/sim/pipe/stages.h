@@ -23,6 +23,7 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    word_t predpc; /* PC predicted to follow this instruction */
 } if_id_ele, *if_id_ptr;
 
 /* ID/EX Pipe Register */
@@ -39,6 +40,7 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    word_t predpc; /* PC predicted to follow this instruction */
 } id_ex_ele, *id_ex_ptr;
 
 /* EX/MEM Pipe Register */
@@ -54,6 +56,7 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    word_t predpc; /* PC predicted to follow this instruction */
 } ex_mem_ele, *ex_mem_ptr;
 
 /* Mem/WB Pipe Register */
@@ -67,6 +70,7 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    word_t predpc; /* PC predicted to follow this instruction */
 } mem_wb_ele, *mem_wb_ptr;
 
 /************ Global Declarations ********************/
@@ -42,6 +42,7 @@ FILE *object_file;       /* Input file handle */
 bool_t verbosity = 2;    /* Verbosity level [TTY only] (-v) */ 
 int instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
 bool_t do_check = FALSE; /* Test with YIS? [TTY only] (-t) */
+static cosim_ptr cosim = NULL; /* ISA stepped in lockstep (-t) */
 
 /************* 
  * End Globals 
@@ -197,7 +198,6 @@ static void run_tty_sim()
     cc_t result_cc = 0;
     int byte_cnt = 0;
     mem_t mem0, reg0;
-    state_ptr isa_state = NULL;
 
 
     /* In TTY mode, the default object file comes from stdin */
@@ -221,14 +221,8 @@ static void run_tty_sim()
 	printf("%d bytes of code read\n", byte_cnt);
     }
     fclose(object_file);
-    if (do_check) {
-	isa_state = new_state(0);
-	free_mem(isa_state->r);
-	free_mem(isa_state->m);
-	isa_state->m = copy_mem(mem);
-	isa_state->r = copy_mem(reg);
-	isa_state->cc = cc;
-    }
+    if (do_check)
+	cosim = new_cosim(mem, reg, cc, stdout);
 
     mem0 = copy_mem(mem);
     reg0 = copy_mem(reg);
@@ -245,33 +239,42 @@ static void run_tty_sim()
 	diff_mem(mem0, mem, stdout);
     }
     if (do_check) {
-	byte_t e = STAT_AOK;
+	state_ptr isa_state = cosim->isa;
+	byte_t e = status;
 	int step;
 	bool_t match = TRUE;
 
-	for (step = 0; step < instr_limit && e == STAT_AOK; step++) {
-	    e = step_state(isa_state, stdout);
-	}
-
-	if (diff_reg(isa_state->r, reg, NULL)) {
+	/* The ISA has been checked at each instruction retired so far */
+	if (cosim->failed) {
 	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Register != Pipeline Register File\n");
-		diff_reg(isa_state->r, reg, stdout);
+	    printf("Lockstep check fails after %d instructions: %s\n",
+		   cosim->steps, cosim->msg);
+	} else {
+	    for (step = cosim->steps; step < instr_limit && e == STAT_AOK;
+		 step++) {
+		e = step_state(isa_state, stdout);
 	    }
-	}
-	if (diff_mem(isa_state->m, mem, NULL)) {
-	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Memory != Pipeline Memory\n");
-		diff_mem(isa_state->m, mem, stdout);
+
+	    if (diff_reg(isa_state->r, reg, NULL)) {
+		match = FALSE;
+		if (verbosity > 0) {
+		    printf("ISA Register != Pipeline Register File\n");
+		    diff_reg(isa_state->r, reg, stdout);
+		}
 	    }
-	}
-	if (isa_state->cc != result_cc) {
-	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
-		       cc_name(isa_state->cc), cc_name(result_cc));
+	    if (diff_mem(isa_state->m, mem, NULL)) {
+		match = FALSE;
+		if (verbosity > 0) {
+		    printf("ISA Memory != Pipeline Memory\n");
+		    diff_mem(isa_state->m, mem, stdout);
+		}
+	    }
+	    if (isa_state->cc != result_cc) {
+		match = FALSE;
+		if (verbosity > 0) {
+		    printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
+			   cc_name(isa_state->cc), cc_name(result_cc));
+		}
 	    }
 	}
 	if (match) {
@@ -375,6 +378,10 @@ word_t mem_addr = 0;
 word_t mem_data = 0;
 byte_t status = STAT_AOK;
 
+/* The instruction whose results update_state writes back (-t) */
+static word_t retire_pc = 0;
+static bool_t retiring = FALSE;
+
 
 /* Values computed by control logic */
 int gen_pc();  /* SEQ+ */
@@ -586,6 +593,7 @@ void sim_reset()
     mem_write = FALSE;
     mem_addr = 0;
     mem_data = 0;
+    retiring = FALSE;
 
     /* Reset intermediate values to clear display */
     icode = I_NOP;
@@ -635,6 +643,8 @@ static void update_state()
       /* Should have already tested this address */
       set_word_val(mem, mem_addr, mem_data);
 	sim_log("Wrote 0x%x to address 0x%x\n", mem_data, mem_addr);
+	if (cosim)
+	    cosim_write(cosim, retire_pc, mem_addr, mem_data);
 #ifdef HAS_GUI
 	    if (gui_mode) {
 		if (mem_addr % 4 != 0) {
@@ -653,6 +663,8 @@ static void update_state()
 	    }
 #endif /* HAS_GUI */
     }
+    if (cosim && retiring)
+	cosim_retire(cosim, retire_pc, STAT_AOK, reg, REG_NONE);
 }
 
 /* Execute one instruction */
@@ -779,6 +791,8 @@ static byte_t sim_step()
 	/* Update PC */
 	pc_in = gen_new_pc();
     } 
+    retire_pc = pc;
+    retiring = TRUE;
     sim_report();
     return status;
 }
@@ -799,9 +813,12 @@ int sim_run(int max_instr, byte_t *statusp, cc_t *ccp)
     while (icount < max_instr) {
 	run_status = sim_step();
 	icount++;
-	if (run_status != STAT_AOK)
+	if (run_status != STAT_AOK || (cosim && cosim->failed))
 	    break;
     }
+    /* The last instruction writes nothing back, but has its status */
+    if (cosim && run_status != STAT_AOK)
+	cosim_retire(cosim, retire_pc, run_status, reg, REG_NONE);
     if (statusp)
 	*statusp = run_status;
     if (ccp)